@@ -182,7 +182,23 @@ static int32_t descrambling_timestamp(uint8_t *in_token_buf,
 	return EOK;
 }
 
-int32_t update_timestamp(const struct tc_ns_smc_cmd *cmd)
+/*
+ * the session of a command is passed down by its caller, which holds
+ * a ref of it during the call; only look it up when it's not known
+ */
+static struct tc_ns_session *get_cmd_session(const struct tc_ns_smc_cmd *cmd,
+	struct tc_ns_session *sess)
+{
+	if (sess && sess->session_id == cmd->context_id) {
+		get_session_struct(sess);
+		return sess;
+	}
+
+	return tc_find_session_by_uuid(cmd->dev_file_id, cmd);
+}
+
+int32_t update_timestamp(const struct tc_ns_smc_cmd *cmd,
+	struct tc_ns_session *sess)
 {
 	struct tc_ns_session *session = NULL;
 	struct session_secure_info *secure_info = NULL;
@@ -202,7 +218,7 @@ int32_t update_timestamp(const struct tc_ns_smc_cmd *cmd)
 			return -EFAULT;
 		}
 
-		session = tc_find_session_by_uuid(cmd->dev_file_id, cmd);
+		session = get_cmd_session(cmd, sess);
 		if (!session) {
 			tlogd("tc_find_session_key find session FAILURE\n");
 			return -EFAULT;
@@ -222,7 +238,8 @@ int32_t update_timestamp(const struct tc_ns_smc_cmd *cmd)
 	return EOK;
 }
 
-int32_t sync_timestamp(const struct tc_ns_smc_cmd *cmd, uint8_t *token,
+int32_t sync_timestamp(const struct tc_ns_smc_cmd *cmd,
+	struct tc_ns_session *sess, uint8_t *token,
 	uint32_t token_len, bool is_global)
 {
 	struct tc_ns_session *session = NULL;
@@ -240,7 +257,7 @@ int32_t sync_timestamp(const struct tc_ns_smc_cmd *cmd, uint8_t *token,
 	if (token[SYNC_INDEX] == UN_SYNCED) {
 		tlogd("flag is UN_SYNC, to sync timestamp!\n");
 
-		session = tc_find_session_by_uuid(cmd->dev_file_id, cmd);
+		session = get_cmd_session(cmd, sess);
 		if (!session) {
 			tloge("sync_timestamp find session FAILURE\n");
 			return -EFAULT;
@@ -274,7 +291,7 @@ static void scrambling_operation(struct tc_ns_smc_cmd *cmd, uint32_t scrambler)
 }
 
 /* calculate cmd checksum and scrambling operation */
-int32_t update_chksum(struct tc_ns_smc_cmd *cmd)
+int32_t update_chksum(struct tc_ns_smc_cmd *cmd, struct tc_ns_session *sess)
 {
 	struct tc_ns_session *session = NULL;
 	struct session_secure_info *secure_info = NULL;
@@ -287,7 +304,7 @@ int32_t update_chksum(struct tc_ns_smc_cmd *cmd)
 
 	/* cmd is invoke command */
 	if (cmd->cmd_type == CMD_TYPE_TA) {
-		session = tc_find_session_by_uuid(cmd->dev_file_id, cmd);
+		session = get_cmd_session(cmd, sess);
 		if (session) {
 			secure_info = &session->secure_info;
 			scrambler_oper =
@@ -299,7 +316,8 @@ int32_t update_chksum(struct tc_ns_smc_cmd *cmd)
 	return EOK;
 }
 
-int32_t verify_chksum(const struct tc_ns_smc_cmd *cmd)
+int32_t verify_chksum(const struct tc_ns_smc_cmd *cmd,
+	struct tc_ns_session *sess)
 {
 	struct tc_ns_session *session = NULL;
 	struct session_secure_info *secure_info = NULL;
@@ -311,7 +329,7 @@ int32_t verify_chksum(const struct tc_ns_smc_cmd *cmd)
 
 	/* cmd is invoke command */
 	if (cmd->cmd_type == CMD_TYPE_TA) {
-		session = tc_find_session_by_uuid(cmd->dev_file_id, cmd);
+		session = get_cmd_session(cmd, sess);
 		if (session) {
 			secure_info = &session->secure_info;
 			put_session_struct(session);
@@ -1108,8 +1126,8 @@ int post_process_token(const struct tc_call_params *call_params,
 		return -EFAULT;
 	}
 
-	if (sync_timestamp(op_params->smc_cmd, tc_token->token_buffer,
-		tc_token->token_len, is_global)) {
+	if (sync_timestamp(op_params->smc_cmd, call_params->sess,
+		tc_token->token_buffer, tc_token->token_len, is_global)) {
 		tloge("sync time stamp error\n");
 		return -EFAULT;
 	}
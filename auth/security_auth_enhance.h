@@ -32,10 +32,13 @@
 
 #ifdef CONFIG_AUTH_ENHANCE
 
-int32_t update_timestamp(const struct tc_ns_smc_cmd *cmd);
-int32_t update_chksum(struct tc_ns_smc_cmd *cmd);
-int32_t verify_chksum(const struct tc_ns_smc_cmd *cmd);
-int32_t sync_timestamp(const struct tc_ns_smc_cmd *cmd, uint8_t *token,
+int32_t update_timestamp(const struct tc_ns_smc_cmd *cmd,
+	struct tc_ns_session *sess);
+int32_t update_chksum(struct tc_ns_smc_cmd *cmd, struct tc_ns_session *sess);
+int32_t verify_chksum(const struct tc_ns_smc_cmd *cmd,
+	struct tc_ns_session *sess);
+int32_t sync_timestamp(const struct tc_ns_smc_cmd *cmd,
+	struct tc_ns_session *sess, uint8_t *token,
 	uint32_t token_len, bool is_global);
 int do_encryption(uint8_t *buffer, uint32_t buffer_size,
 	uint32_t payload_size, const uint8_t *key);
@@ -58,22 +61,26 @@ int get_session_root_key(uint32_t *buffer, uint32_t size);
 
 #else
 
-static inline int32_t update_timestamp(const struct tc_ns_smc_cmd *cmd)
+static inline int32_t update_timestamp(const struct tc_ns_smc_cmd *cmd,
+	struct tc_ns_session *sess)
 {
 	return 0;
 }
 
-static inline int32_t update_chksum(struct tc_ns_smc_cmd *cmd)
+static inline int32_t update_chksum(struct tc_ns_smc_cmd *cmd,
+	struct tc_ns_session *sess)
 {
 	return 0;
 }
 
-static inline int32_t verify_chksum(const struct tc_ns_smc_cmd *cmd)
+static inline int32_t verify_chksum(const struct tc_ns_smc_cmd *cmd,
+	struct tc_ns_session *sess)
 {
 	return 0;
 }
 
-static inline int32_t sync_timestamp(const struct tc_ns_smc_cmd *cmd, uint8_t *token,
+static inline int32_t sync_timestamp(const struct tc_ns_smc_cmd *cmd,
+	struct tc_ns_session *sess, uint8_t *token,
 	uint32_t token_len, bool is_global)
 {
 	return 0;
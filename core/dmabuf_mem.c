@@ -0,0 +1,255 @@
+/*
+ * dmabuf_mem.c
+ *
+ * dma-buf import for ion params of invoke, so buffers of media
+ * pipelines are passed to TA by physical address without any copy.
+ *
+ * Copyright (c) 2012-2021 Huawei Technologies Co., Ltd.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include "dmabuf_mem.h"
+#include <linux/dma-buf.h>
+#include <linux/dma-mapping.h>
+#include <linux/iommu.h>
+#include <linux/platform_device.h>
+#include <linux/scatterlist.h>
+#include <linux/module.h>
+#include <linux/err.h>
+#include <linux/version.h>
+#include <securec.h>
+#include "tc_ns_log.h"
+
+#ifdef CONFIG_TEE_DMABUF_PARAM
+
+#if (KERNEL_VERSION(6, 13, 0) <= LINUX_VERSION_CODE)
+MODULE_IMPORT_NS("DMA_BUF");
+#elif (KERNEL_VERSION(5, 16, 0) <= LINUX_VERSION_CODE)
+MODULE_IMPORT_NS(DMA_BUF);
+#endif
+
+/*
+ * dma-bufs are attached to a device of our own, which sits behind no
+ * iommu and reaches all of RAM, so the dma addresses the exporter maps
+ * for it are the physical addresses TEE needs
+ */
+static struct platform_device *g_dmabuf_pdev;
+
+int tc_dmabuf_init(void)
+{
+	int ret;
+
+	g_dmabuf_pdev = platform_device_register_simple("tzdriver_dmabuf",
+		PLATFORM_DEVID_NONE, NULL, 0);
+	if (IS_ERR_OR_NULL(g_dmabuf_pdev)) {
+		tloge("register dma buf device failed\n");
+		g_dmabuf_pdev = NULL;
+		return -ENODEV;
+	}
+
+	/* TEE reaches all of RAM, keep swiotlb from bouncing the buffer */
+	ret = dma_coerce_mask_and_coherent(&g_dmabuf_pdev->dev,
+		DMA_BIT_MASK(64));
+	if (ret) {
+		tloge("set dma mask of dma buf device failed\n");
+		tc_dmabuf_exit();
+		return ret;
+	}
+
+	/* an iova would mean nothing to TEE */
+	if (iommu_get_domain_for_dev(&g_dmabuf_pdev->dev)) {
+		tloge("dma buf device is behind an iommu\n");
+		tc_dmabuf_exit();
+		return -ENODEV;
+	}
+	return 0;
+}
+
+void tc_dmabuf_exit(void)
+{
+	if (!g_dmabuf_pdev)
+		return;
+
+	platform_device_unregister(g_dmabuf_pdev);
+	g_dmabuf_pdev = NULL;
+}
+
+static struct sg_table *map_attachment(struct dma_buf_attachment *attach)
+{
+#if (KERNEL_VERSION(6, 2, 0) <= LINUX_VERSION_CODE)
+	return dma_buf_map_attachment_unlocked(attach, DMA_BIDIRECTIONAL);
+#else
+	return dma_buf_map_attachment(attach, DMA_BIDIRECTIONAL);
+#endif
+}
+
+static void unmap_attachment(struct dma_buf_attachment *attach,
+	struct sg_table *sgt)
+{
+#if (KERNEL_VERSION(6, 2, 0) <= LINUX_VERSION_CODE)
+	dma_buf_unmap_attachment_unlocked(attach, sgt, DMA_BIDIRECTIONAL);
+#else
+	dma_buf_unmap_attachment(attach, sgt, DMA_BIDIRECTIONAL);
+#endif
+}
+
+int tc_dmabuf_import(int fd, uint32_t size, struct tc_ns_dmabuf *buf)
+{
+	int ret;
+
+	if (!buf || !g_dmabuf_pdev || !size)
+		return -EINVAL;
+
+	buf->dmabuf = dma_buf_get(fd);
+	if (IS_ERR_OR_NULL(buf->dmabuf)) {
+		tloge("get dma buf of fd %d failed\n", fd);
+		buf->dmabuf = NULL;
+		return -EBADF;
+	}
+
+	if (size > buf->dmabuf->size) {
+		tloge("size %u is larger than dma buf %zu\n",
+			size, buf->dmabuf->size);
+		ret = -EINVAL;
+		goto put_buf;
+	}
+
+	buf->attach = dma_buf_attach(buf->dmabuf, &g_dmabuf_pdev->dev);
+	if (IS_ERR_OR_NULL(buf->attach)) {
+		tloge("attach dma buf failed\n");
+		ret = -EINVAL;
+		goto put_buf;
+	}
+
+	buf->sgt = map_attachment(buf->attach);
+	if (IS_ERR_OR_NULL(buf->sgt)) {
+		tloge("map dma buf failed\n");
+		ret = -ENOMEM;
+		goto detach;
+	}
+	buf->size = size;
+	return 0;
+
+detach:
+	dma_buf_detach(buf->dmabuf, buf->attach);
+put_buf:
+	dma_buf_put(buf->dmabuf);
+	(void)memset_s(buf, sizeof(*buf), 0, sizeof(*buf));
+	return ret;
+}
+
+void tc_dmabuf_release(struct tc_ns_dmabuf *buf)
+{
+	if (!buf || !buf->dmabuf)
+		return;
+
+	unmap_attachment(buf->attach, buf->sgt);
+	dma_buf_detach(buf->dmabuf, buf->attach);
+	dma_buf_put(buf->dmabuf);
+	(void)memset_s(buf, sizeof(*buf), 0, sizeof(*buf));
+}
+
+/*
+ * walk the physically contiguous chunks covering the first size
+ * bytes of the buffer, adjacent sg entries are merged; only the dma
+ * side of the table is valid for an importer
+ */
+static uint32_t walk_chunks(const struct tc_ns_dmabuf *buf,
+	struct ion_page_info *info, uint32_t info_num)
+{
+	struct scatterlist *sg = NULL;
+	uint64_t left = buf->size;
+	uint64_t chunk_addr = 0;
+	uint64_t chunk_len = 0;
+	uint32_t num = 0;
+	unsigned int i;
+
+	for_each_sg(buf->sgt->sgl, sg, buf->sgt->nents, i) {
+		uint64_t addr = (uint64_t)sg_dma_address(sg);
+		uint64_t len = sg_dma_len(sg);
+
+		if (!left)
+			break;
+		if (len > left)
+			len = left;
+		left -= len;
+		if (chunk_len && chunk_addr + chunk_len == addr) {
+			chunk_len += len;
+			continue;
+		}
+		if (chunk_len && info && num < info_num) {
+			info[num].phys_addr = chunk_addr;
+			info[num].npages = PAGE_ALIGN(chunk_len) >> PAGE_SHIFT;
+		}
+		if (chunk_len)
+			num++;
+		chunk_addr = addr;
+		chunk_len = len;
+	}
+	if (chunk_len && info && num < info_num) {
+		info[num].phys_addr = chunk_addr;
+		info[num].npages = PAGE_ALIGN(chunk_len) >> PAGE_SHIFT;
+	}
+	if (chunk_len)
+		num++;
+	/* mapping is shorter than the size asked */
+	return left ? 0 : num;
+}
+
+int tc_dmabuf_get_phys(const struct tc_ns_dmabuf *buf, phys_addr_t *phys)
+{
+	struct ion_page_info info = {0};
+
+	if (!buf || !buf->sgt || !phys)
+		return -EINVAL;
+
+	if (walk_chunks(buf, &info, 1) != 1) {
+		tloge("dma buf is not physically contiguous\n");
+		return -EINVAL;
+	}
+	*phys = (phys_addr_t)info.phys_addr;
+	return 0;
+}
+
+size_t tc_dmabuf_sglist_size(const struct tc_ns_dmabuf *buf)
+{
+	uint32_t num;
+
+	if (!buf || !buf->sgt)
+		return 0;
+
+	num = walk_chunks(buf, NULL, 0);
+	if (!num)
+		return 0;
+	return sizeof(struct sglist) + num * sizeof(struct ion_page_info);
+}
+
+int tc_dmabuf_fill_sglist(const struct tc_ns_dmabuf *buf,
+	struct sglist *sglist, size_t sglist_len)
+{
+	uint32_t info_num;
+
+	if (!buf || !buf->sgt || !sglist ||
+		sglist_len < sizeof(*sglist))
+		return -EINVAL;
+
+	info_num = (uint32_t)((sglist_len - sizeof(*sglist)) /
+		sizeof(struct ion_page_info));
+	if (walk_chunks(buf, sglist->page_info, info_num) != info_num)
+		return -EINVAL;
+
+	sglist->sglist_size = sglist_len;
+	sglist->ion_size = buf->size;
+	sglist->ion_id = 0;
+	sglist->info_length = info_num;
+	return 0;
+}
+#endif
@@ -0,0 +1,74 @@
+/*
+ * dmabuf_mem.h
+ *
+ * dma-buf import for ion params of invoke.
+ *
+ * Copyright (c) 2012-2021 Huawei Technologies Co., Ltd.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef DMABUF_MEM_H
+#define DMABUF_MEM_H
+
+#include <linux/types.h>
+
+struct dma_buf;
+struct dma_buf_attachment;
+struct sg_table;
+
+/* dma-buf imported for one param, released after the invoke */
+struct tc_ns_dmabuf {
+	struct dma_buf *dmabuf;
+	struct dma_buf_attachment *attach;
+	struct sg_table *sgt;
+	uint32_t size;
+};
+
+struct ion_page_info {
+	uint64_t phys_addr;
+	uint64_t npages;
+};
+
+/* TEEC_ION_SGLIST_INPUT, physical chunks of the dma-buf */
+struct sglist {
+	uint64_t sglist_size;
+	uint64_t ion_size;
+	uint64_t ion_id;
+	uint64_t info_length;
+	struct ion_page_info page_info[0];
+};
+
+#ifdef CONFIG_TEE_DMABUF_PARAM
+int tc_dmabuf_init(void);
+void tc_dmabuf_exit(void);
+int tc_dmabuf_import(int fd, uint32_t size, struct tc_ns_dmabuf *buf);
+void tc_dmabuf_release(struct tc_ns_dmabuf *buf);
+int tc_dmabuf_get_phys(const struct tc_ns_dmabuf *buf, phys_addr_t *phys);
+size_t tc_dmabuf_sglist_size(const struct tc_ns_dmabuf *buf);
+int tc_dmabuf_fill_sglist(const struct tc_ns_dmabuf *buf,
+	struct sglist *sglist, size_t sglist_len);
+#else
+static inline int tc_dmabuf_init(void)
+{
+	return 0;
+}
+
+static inline void tc_dmabuf_exit(void)
+{
+}
+
+static inline void tc_dmabuf_release(struct tc_ns_dmabuf *buf)
+{
+	(void)buf;
+}
+#endif
+
+#endif
@@ -44,6 +44,13 @@
 #include "tlogger.h"
 
 #define MAX_SHARED_SIZE 0x100000      /* 1 MiB */
+/* each cached invoke ctx holds a cmd pack, limit their total bytes */
+#define INVOKE_CTX_PACK_SIZE SZ_4K
+#define MAX_INVOKE_CTX_BYTES (MAILBOX_POOL_SIZE / 32)
+#ifdef CONFIG_SHARED_MEM_PAGELIST
+#define PIN_TMP_MEM_THRESHOLD 0x40000 /* 256 KiB, pin instead of copy */
+#define MAX_PIN_TMP_MEM_SIZE 0x4000000 /* 64 MiB */
+#endif
 
 static void free_operation(const struct tc_call_params *call_params,
 	struct tc_op_params *op_params);
@@ -214,6 +221,26 @@ static bool is_usr_valmem_valid(union tc_ns_client_param *client_param)
 	return true;
 }
 
+#ifdef CONFIG_SHARED_MEM_PAGELIST
+/* buffer is index of fixed buf, only size is in CA memory */
+static bool is_usr_fixedmem_valid(union tc_ns_client_param *client_param)
+{
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(4, 19, 18) || \
+	LINUX_VERSION_CODE == KERNEL_VERSION(4, 19, 71))
+	if (!access_ok(VERIFY_READ,
+		(void *)(uintptr_t)client_param->memref.size_addr,
+		sizeof(uint32_t)))
+#else
+	if (!access_ok(
+		(void *)(uintptr_t)client_param->memref.size_addr,
+		sizeof(uint32_t)))
+#endif
+		return false;
+
+	return true;
+}
+#endif
+
 bool tc_user_param_valid(struct tc_ns_client_context *client_context,
 	unsigned int index)
 {
@@ -234,6 +261,11 @@ bool tc_user_param_valid(struct tc_ns_client_context *client_context,
 	if (is_mem_param(param_type)) {
 		if (!is_usr_refmem_valid(client_param))
 			return false;
+#ifdef CONFIG_SHARED_MEM_PAGELIST
+	} else if (param_type == TEEC_MEMREF_FIXED_INOUT) {
+		if (!is_usr_fixedmem_valid(client_param))
+			return false;
+#endif
 	} else if (is_val_param(param_type)) {
 		if (!is_usr_valmem_valid(client_param))
 			return false;
@@ -320,6 +352,142 @@ int write_to_client(void __user *dest, size_t dest_size,
 	return 0;
 }
 
+/*
+ * libteec points the value and size fields of all params into one
+ * TEEC_Operation, so they are read by one copy from user before the
+ * params are set up and written back by one copy after the call,
+ * instead of a copy per field; fields out of the window fall back
+ */
+static void add_snap_field(uint64_t addr, uint64_t *start, uint64_t *end)
+{
+	if (addr > U64_MAX - sizeof(uint32_t)) {
+		*start = 0;
+		*end = U64_MAX;
+		return;
+	}
+	if (addr < *start)
+		*start = addr;
+	if (addr + sizeof(uint32_t) > *end)
+		*end = addr + sizeof(uint32_t);
+}
+
+static void snap_client_params(const struct tc_call_params *call_params,
+	struct tc_op_params *op_params)
+{
+	struct tc_param_snap *snap = &op_params->param_snap;
+	const union tc_ns_client_param *client_param = NULL;
+	uint64_t start = U64_MAX;
+	uint64_t end = 0;
+	uint32_t param_type;
+	unsigned int index;
+
+	snap->len = 0;
+	if (call_params->dev->kernel_api != TEE_REQ_FROM_USER_MODE)
+		return;
+
+	for (index = 0; index < TEE_PARAM_NUM; index++) {
+		/* params 2/3 of login are filled by kernel */
+		if ((call_params->flags & TC_CALL_LOGIN) && (index >= 2))
+			break;
+		client_param = &(call_params->context->params[index]);
+		param_type = teec_param_type_get(
+			call_params->context->param_types, index);
+		if (is_val_param(param_type)) {
+			add_snap_field(client_param->value.a_addr, &start, &end);
+			add_snap_field(client_param->value.b_addr, &start, &end);
+		} else if (is_mem_param(param_type)
+#ifdef CONFIG_SHARED_MEM_PAGELIST
+			|| param_type == TEEC_MEMREF_FIXED_INOUT
+#endif
+			) {
+			add_snap_field(client_param->memref.size_addr,
+				&start, &end);
+		}
+	}
+
+	if (end <= start || end - start > PARAM_SNAP_SIZE)
+		return;
+	if (copy_from_user(snap->data, (void __user *)(uintptr_t)start,
+		end - start)) {
+		tlogd("params are not in one window, copy per field\n");
+		return;
+	}
+	snap->base = start;
+	snap->len = (uint32_t)(end - start);
+	bitmap_zero(snap->dirty, PARAM_SNAP_SIZE);
+}
+
+static uint8_t *snap_field(struct tc_param_snap *snap, uint64_t addr)
+{
+	if (!snap->len || addr < snap->base ||
+		addr - snap->base > snap->len - sizeof(uint32_t))
+		return NULL;
+
+	return snap->data + (addr - snap->base);
+}
+
+static int read_client_word(struct tc_op_params *op_params,
+	uint32_t *dest, uint64_t addr, uint8_t kernel_params)
+{
+	uint8_t *field = NULL;
+
+	if (kernel_params == TEE_REQ_FROM_USER_MODE)
+		field = snap_field(&op_params->param_snap, addr);
+	if (field)
+		return memcpy_s(dest, sizeof(*dest), field,
+			sizeof(*dest)) ? -EFAULT : 0;
+
+	return read_from_client(dest, sizeof(*dest),
+		(void __user *)(uintptr_t)addr, sizeof(*dest), kernel_params);
+}
+
+static int write_client_word(const struct tc_call_params *call_params,
+	struct tc_op_params *op_params, uint64_t addr, uint32_t val)
+{
+	struct tc_param_snap *snap = &op_params->param_snap;
+	uint8_t *field = snap_field(snap, addr);
+
+	if (!field)
+		return write_to_client((void __user *)(uintptr_t)addr,
+			sizeof(val), &val, sizeof(val),
+			call_params->dev->kernel_api);
+
+	if (memcpy_s(field, sizeof(val), &val, sizeof(val)))
+		return -EFAULT;
+	bitmap_set(snap->dirty, (unsigned int)(field - snap->data),
+		sizeof(val));
+	return 0;
+}
+
+/*
+ * write back only the bytes kernel wrote, one copy per run of
+ * touching fields, clean bytes between them stay as the CA has them
+ */
+static int flush_client_words(struct tc_op_params *op_params)
+{
+	struct tc_param_snap *snap = &op_params->param_snap;
+	unsigned int start;
+	unsigned int end = 0;
+	int ret = 0;
+
+	if (!snap->len)
+		return 0;
+
+	for (;;) {
+		start = find_next_bit(snap->dirty, snap->len, end);
+		if (start >= snap->len)
+			break;
+		end = find_next_zero_bit(snap->dirty, snap->len, start);
+		if (copy_to_user((void __user *)(uintptr_t)(snap->base + start),
+			snap->data + start, end - start)) {
+			tloge("copy params to user failed\n");
+			ret = -EFAULT;
+		}
+	}
+	bitmap_zero(snap->dirty, PARAM_SNAP_SIZE);
+	return ret;
+}
+
 static bool is_input_tempmem(unsigned int param_type)
 {
 	if (param_type == TEEC_MEMREF_TEMP_INPUT ||
@@ -362,6 +530,82 @@ static int do_opensess_auth_enhance(const struct tc_call_params *call_params,
 	return 0;
 }
 
+/* mailbox for client params is charged to the dev file who asks for it */
+static int charge_param_mem(const struct tc_call_params *call_params,
+	struct tc_op_params *op_params, uint32_t size, unsigned int index)
+{
+	int ret = mailbox_charge(&call_params->dev->mb_usage, size);
+
+	if (ret)
+		return ret;
+
+	op_params->mb_charged[index] = size;
+	return 0;
+}
+
+static void uncharge_param_mem(const struct tc_call_params *call_params,
+	struct tc_op_params *op_params, unsigned int index)
+{
+	if (!op_params->mb_charged[index])
+		return;
+
+	mailbox_uncharge(&call_params->dev->mb_usage,
+		op_params->mb_charged[index]);
+	op_params->mb_charged[index] = 0;
+}
+
+#ifdef CONFIG_SHARED_MEM_PAGELIST
+static bool need_pin_tmp_mem(const struct tc_call_params *call_params,
+	uint8_t kernel_params, uint32_t buffer_size, unsigned int index)
+{
+	/* login info of open session is encrypted in mailbox copy */
+	return kernel_params == TEE_REQ_FROM_USER_MODE &&
+		buffer_size > PIN_TMP_MEM_THRESHOLD &&
+		!is_opensession_by_index(call_params->flags,
+		call_params->context->cmd_id, index);
+}
+
+/*
+ * large temp buffer of user CA is pinned and passed by page list,
+ * TEE reads and writes CA pages in place, no copy in or copy out
+ */
+static int alloc_for_pinned_tmp_mem(const struct tc_call_params *call_params,
+	struct tc_op_params *op_params, uint32_t buffer_size,
+	uint32_t param_type, unsigned int index)
+{
+	union tc_ns_client_param *client_param =
+		&(call_params->context->params[index]);
+	void __user *user_addr =
+		(void __user *)(uintptr_t)client_param->memref.buffer;
+	void *info = NULL;
+
+	if (buffer_size > MAX_PIN_TMP_MEM_SIZE) {
+		tloge("buffer size %u from user is too large\n", buffer_size);
+		return -EFAULT;
+	}
+
+	if (charge_param_mem(call_params, op_params, tc_mem_pagelist_size(
+		offset_in_page((uintptr_t)user_addr), buffer_size), index))
+		return -ENOMEM;
+
+	if (tc_mem_pin_user_buf(user_addr, buffer_size,
+		param_type != TEEC_MEMREF_TEMP_INPUT,
+		&op_params->local_tmpbuf[index]))
+		return -EFAULT;
+
+	info = op_params->local_tmpbuf[index].temp_buffer;
+	op_params->mb_pack->operation.params[index].memref.buffer =
+		virt_to_phys(info);
+	op_params->mb_pack->operation.buffer_h_addr[index] =
+		(uint64_t)virt_to_phys(info) >> ADDR_TRANS_NUM;
+	op_params->mb_pack->operation.params[index].memref.size = buffer_size;
+	/* TEEC_MEMREF_TEMP_XXX + 8 equal to TEE_PARAM_TYPE_MEMREF_PAGELIST_XXX */
+	op_params->trans_paramtype[index] = param_type +
+		(TEE_PARAM_TYPE_MEMREF_PAGELIST_INPUT - TEEC_MEMREF_TEMP_INPUT);
+	return 0;
+}
+#endif
+
 /*
  * temp buffers we need to allocate/deallocate
  * for every operation
@@ -380,19 +624,33 @@ static int alloc_for_tmp_mem(const struct tc_call_params *call_params,
 
 	/* For compatibility sake we assume buffer size to be 32bits */
 	client_param = &(call_params->context->params[index]);
-	if (read_from_client(&buffer_size, sizeof(buffer_size),
-		(uint32_t __user *)(uintptr_t)client_param->memref.size_addr,
-		sizeof(uint32_t), kernel_params)) {
+	if (read_client_word(op_params, &buffer_size,
+		client_param->memref.size_addr, kernel_params)) {
 		tloge("copy memref.size_addr failed\n");
 		return -EFAULT;
 	}
 
+#ifdef CONFIG_SHARED_MEM_PAGELIST
+	if (need_pin_tmp_mem(call_params, kernel_params, buffer_size, index))
+		return alloc_for_pinned_tmp_mem(call_params, op_params,
+			buffer_size, param_type, index);
+#endif
+
 	if (buffer_size > MAX_SHARED_SIZE) {
 		tloge("buffer size %u from user is too large\n", buffer_size);
 		return -EFAULT;
 	}
 
-	temp_buf = mailbox_alloc(buffer_size, MB_FLAG_ZERO);
+	if (buffer_size && charge_param_mem(call_params, op_params,
+		buffer_size, index))
+		return -ENOMEM;
+
+	/*
+	 * transient pool exhaustion should queue the caller, not fail it;
+	 * input buffers are overwritten by the copy in, only clean output
+	 */
+	temp_buf = mailbox_alloc(buffer_size, MB_FLAG_WAIT |
+		(is_input_tempmem(param_type) ? 0 : MB_FLAG_ZERO));
 	if (!temp_buf) {
 		tloge("temp buf malloc failed, i = %u\n", index);
 		return -ENOMEM;
@@ -419,12 +677,12 @@ static int alloc_for_tmp_mem(const struct tc_call_params *call_params,
 	return 0;
 }
 
-static int check_buffer_for_ref(uint32_t *buffer_size,
-	const union tc_ns_client_param *client_param, uint8_t kernel_params)
+static int check_buffer_for_ref(struct tc_op_params *op_params,
+	uint32_t *buffer_size, const union tc_ns_client_param *client_param,
+	uint8_t kernel_params)
 {
-	if (read_from_client(buffer_size, sizeof(*buffer_size),
-		(uint32_t __user *)(uintptr_t)client_param->memref.size_addr,
-		sizeof(uint32_t), kernel_params)) {
+	if (read_client_word(op_params, buffer_size,
+		client_param->memref.size_addr, kernel_params)) {
 		tloge("copy memref.size_addr failed\n");
 		return -EFAULT;
 	}
@@ -465,6 +723,79 @@ static bool is_phyaddr_valid(struct tc_ns_operation *operation, int index)
 	return true;
 }
 
+#ifdef CONFIG_SHARED_MEM_PAGELIST
+/*
+ * registered sharemem is vmalloc memory pinned by the driver, so TEE can
+ * access it in place through a page list instead of a mailbox copy
+ */
+static void *alloc_ref_mailbox(const struct tc_ns_shared_mem *shared_mem,
+	uint32_t offset, uint32_t buffer_size, uint32_t param_type)
+{
+	size_t info_len = tc_mem_pagelist_size(offset, buffer_size);
+	struct pagelist_info *info = mailbox_alloc(info_len, MB_FLAG_ZERO);
+
+	(void)param_type;
+	if (!info)
+		return NULL;
+
+	if (tc_mem_fill_pagelist(shared_mem, offset, buffer_size,
+		info, info_len)) {
+		mailbox_free(info);
+		return NULL;
+	}
+	return info;
+}
+
+static inline size_t ref_mailbox_size(uint32_t offset, uint32_t buffer_size)
+{
+	return tc_mem_pagelist_size(offset, buffer_size);
+}
+
+/* TEEC_MEMREF_PARTIAL_XXXXX equal to TEE_PARAM_TYPE_MEMREF_PAGELIST_XXXXX */
+static inline uint32_t ref_trans_paramtype(uint32_t param_type)
+{
+	return param_type;
+}
+
+static inline bool is_pagelist_paramtype(uint32_t trans_type)
+{
+	return trans_type >= TEE_PARAM_TYPE_MEMREF_PAGELIST_INPUT &&
+		trans_type <= TEE_PARAM_TYPE_MEMREF_PAGELIST_INOUT;
+}
+#else
+static void *alloc_ref_mailbox(const struct tc_ns_shared_mem *shared_mem,
+	uint32_t offset, uint32_t buffer_size, uint32_t param_type)
+{
+	void *buffer_addr = (void *)(uintptr_t)(
+		(uintptr_t)shared_mem->kernel_addr + offset);
+
+	/* TA only writes output buffer, no need to copy sharemem in */
+	if (param_type == TEEC_MEMREF_PARTIAL_OUTPUT)
+		return mailbox_alloc(buffer_size, MB_FLAG_ZERO);
+
+	return mailbox_copy_alloc(buffer_addr, buffer_size);
+}
+
+static inline size_t ref_mailbox_size(uint32_t offset, uint32_t buffer_size)
+{
+	(void)offset;
+	return buffer_size;
+}
+
+/* Change TEEC_MEMREF_PARTIAL_XXXXX  to TEE_PARAM_TYPE_MEMREF_XXXXX */
+static inline uint32_t ref_trans_paramtype(uint32_t param_type)
+{
+	return param_type -
+		(TEEC_MEMREF_PARTIAL_INPUT - TEE_PARAM_TYPE_MEMREF_INPUT);
+}
+
+static inline bool is_pagelist_paramtype(uint32_t trans_type)
+{
+	(void)trans_type;
+	return false;
+}
+#endif
+
 /*
  * MEMREF_PARTIAL buffers are already allocated so we just
  * need to search for the shared_mem ref;
@@ -478,59 +809,130 @@ static int alloc_for_ref_mem(const struct tc_call_params *call_params,
 	struct tc_ns_shared_mem *shared_mem = NULL;
 	uint32_t buffer_size = 0;
 	void *buffer_addr = NULL;
-	int ret = 0;
 
 	/* this never happens */
 	if (index >= TEE_PARAM_NUM)
 		return -EINVAL;
 
 	client_param = &(call_params->context->params[index]);
-	if (check_buffer_for_ref(&buffer_size, client_param, kernel_params))
+	if (check_buffer_for_ref(op_params, &buffer_size, client_param,
+		kernel_params))
 		return -EINVAL;
 
 	op_params->mb_pack->operation.params[index].memref.buffer = 0;
 
-	mutex_lock(&call_params->dev->shared_mem_lock);
-	list_for_each_entry(shared_mem,
-		&call_params->dev->shared_mem_list, head) {
-		if (shared_mem->user_addr !=
-			(void *)(uintptr_t)client_param->memref.buffer)
-			continue;
-		if (!is_refmem_offset_valid(shared_mem, client_param,
-			buffer_size)) {
-			break;
-		}
-		buffer_addr = (void *)(uintptr_t)(
-			(uintptr_t)shared_mem->kernel_addr +
-			client_param->memref.offset);
-		buffer_addr = mailbox_copy_alloc(buffer_addr, buffer_size);
-		if (!buffer_addr) {
-			ret = -ENOMEM;
-			break;
-		}
-		op_params->mb_pack->operation.mb_buffer[index] = buffer_addr;
-		op_params->mb_pack->operation.params[index].memref.buffer =
-			virt_to_phys(buffer_addr);
-		op_params->mb_pack->operation.buffer_h_addr[index] =
-			(uint64_t)virt_to_phys(buffer_addr) >> ADDR_TRANS_NUM;
-		op_params->mb_pack->operation.sharemem[index] = shared_mem;
-		get_sharemem_struct(shared_mem);
-		break;
-	}
-	mutex_unlock(&call_params->dev->shared_mem_lock);
-	if (ret != 0)
-		return ret;
+	if (charge_param_mem(call_params, op_params, ref_mailbox_size(
+		client_param->memref.offset, buffer_size), index))
+		return -ENOMEM;
+
+	shared_mem = tc_mem_find_get(call_params->dev,
+		(void *)(uintptr_t)client_param->memref.buffer);
+	if (!shared_mem) {
+		tloge("no sharemem mapped at the buffer addr\n");
+		return -EINVAL;
+	}
+
+	if (!is_refmem_offset_valid(shared_mem, client_param, buffer_size)) {
+		put_sharemem_struct(shared_mem);
+		return -EINVAL;
+	}
+
+	buffer_addr = alloc_ref_mailbox(shared_mem,
+		client_param->memref.offset, buffer_size, param_type);
+	if (!buffer_addr) {
+		put_sharemem_struct(shared_mem);
+		return -ENOMEM;
+	}
+	/* remember size of the copy, bound of copy out */
+	op_params->local_tmpbuf[index].size = buffer_size;
+	op_params->mb_pack->operation.mb_buffer[index] = buffer_addr;
+	op_params->mb_pack->operation.params[index].memref.buffer =
+		virt_to_phys(buffer_addr);
+	op_params->mb_pack->operation.buffer_h_addr[index] =
+		(uint64_t)virt_to_phys(buffer_addr) >> ADDR_TRANS_NUM;
+	/* the ref got by tc_mem_find_get is put in free_operation */
+	op_params->mb_pack->operation.sharemem[index] = shared_mem;
 
 	if (!is_phyaddr_valid(&op_params->mb_pack->operation, index))
 		return -EINVAL;
 
 	op_params->mb_pack->operation.params[index].memref.size = buffer_size;
-	/* Change TEEC_MEMREF_PARTIAL_XXXXX  to TEE_PARAM_TYPE_MEMREF_XXXXX */
-	op_params->trans_paramtype[index] = param_type -
-		(TEEC_MEMREF_PARTIAL_INPUT - TEE_PARAM_TYPE_MEMREF_INPUT);
-	return ret;
+	op_params->trans_paramtype[index] = ref_trans_paramtype(param_type);
+	return 0;
 }
 
+#ifdef CONFIG_SHARED_MEM_PAGELIST
+/*
+ * fixed buf is already mapped by TEE, only pass its handle
+ * and the range of this invoke, nothing to copy or describe
+ */
+static int alloc_for_fixed_mem(const struct tc_call_params *call_params,
+	struct tc_op_params *op_params, uint8_t kernel_params,
+	uint32_t param_type, unsigned int index)
+{
+	union tc_ns_client_param *client_param = NULL;
+	struct tc_ns_fixed_buf *fixed_buf = NULL;
+	struct tc_ns_operation *operation = &op_params->mb_pack->operation;
+	uint32_t buffer_size = 0;
+	uint64_t offset;
+
+	/* this never happens */
+	if (index >= TEE_PARAM_NUM)
+		return -EINVAL;
+
+	client_param = &(call_params->context->params[index]);
+	if (check_buffer_for_ref(op_params, &buffer_size, client_param,
+		kernel_params))
+		return -EINVAL;
+
+	fixed_buf = tc_mem_fixed_buf_get(call_params->dev,
+		(uint32_t)client_param->memref.buffer);
+	if (!fixed_buf) {
+		tloge("fixed buf %llu is not registered\n",
+			client_param->memref.buffer);
+		return -EINVAL;
+	}
+	op_params->fixed_buf[index] = fixed_buf;
+
+	offset = client_param->memref.offset;
+	if (offset >= fixed_buf->buf.size ||
+		fixed_buf->buf.size - offset < buffer_size) {
+		tloge("invalid fixed buf range %llu/%u\n", offset, buffer_size);
+		return -EINVAL;
+	}
+
+	operation->params[index].memref.buffer = (unsigned int)offset;
+	operation->params[index].memref.size = buffer_size;
+	operation->buffer_h_addr[index] = fixed_buf->tee_handle;
+	op_params->local_tmpbuf[index].size = buffer_size;
+	/* TEEC_MEMREF_FIXED_INOUT equal to TEE_PARAM_TYPE_MEMREF_FIXED_INOUT */
+	op_params->trans_paramtype[index] = param_type;
+	return 0;
+}
+
+static int update_for_fixed_mem(const struct tc_call_params *call_params,
+	struct tc_op_params *op_params, unsigned int index)
+{
+	union tc_ns_client_param *client_param = NULL;
+	uint32_t buffer_size;
+
+	if (index >= TEE_PARAM_NUM) {
+		tloge("index is invalid\n");
+		return -EFAULT;
+	}
+
+	/* data is written to CA pages in place, only update size */
+	buffer_size = op_params->mb_pack->operation.params[index].memref.size;
+	client_param = &(call_params->context->params[index]);
+	if (write_client_word(call_params, op_params,
+		client_param->memref.size_addr, buffer_size)) {
+		tloge("copy fixed buf size failed\n");
+		return -EFAULT;
+	}
+	return 0;
+}
+#endif
+
 static int transfer_client_value(const struct tc_call_params *call_params,
 	struct tc_op_params *op_params, uint8_t kernel_params,
 	uint32_t param_type, unsigned int index)
@@ -543,19 +945,13 @@ static int transfer_client_value(const struct tc_call_params *call_params,
 		return -EINVAL;
 
 	client_param = &(call_params->context->params[index]);
-	if (read_from_client(&operation->params[index].value.a,
-		sizeof(operation->params[index].value.a),
-		(void *)(uintptr_t)client_param->value.a_addr,
-		sizeof(operation->params[index].value.a),
-		kernel_params)) {
+	if (read_client_word(op_params, &operation->params[index].value.a,
+		client_param->value.a_addr, kernel_params)) {
 		tloge("copy valuea failed\n");
 		return -EFAULT;
 	}
-	if (read_from_client(&operation->params[index].value.b,
-		sizeof(operation->params[index].value.b),
-		(void *)(uintptr_t)client_param->value.b_addr,
-		sizeof(operation->params[index].value.b),
-		kernel_params)) {
+	if (read_client_word(op_params, &operation->params[index].value.b,
+		client_param->value.b_addr, kernel_params)) {
 		tloge("copy valueb failed\n");
 		return -EFAULT;
 	}
@@ -565,6 +961,98 @@ static int transfer_client_value(const struct tc_call_params *call_params,
 	return 0;
 }
 
+#ifdef CONFIG_TEE_DMABUF_PARAM
+/* dma-buf fd of ion params is in value.a and the size to pass in value.b */
+static int import_ion_param(const struct tc_call_params *call_params,
+	struct tc_op_params *op_params, uint8_t kernel_params,
+	unsigned int index)
+{
+	union tc_ns_client_param *client_param =
+		&(call_params->context->params[index]);
+	uint32_t fd = 0;
+	uint32_t size = 0;
+
+	if (read_client_word(op_params, &fd, client_param->value.a_addr,
+		kernel_params) ||
+		read_client_word(op_params, &size, client_param->value.b_addr,
+		kernel_params)) {
+		tloge("copy ion fd or size failed\n");
+		return -EFAULT;
+	}
+
+	return tc_dmabuf_import((int)fd, size, &op_params->dmabuf[index]);
+}
+
+static int alloc_for_ion_sglist(const struct tc_call_params *call_params,
+	struct tc_op_params *op_params, uint8_t kernel_params,
+	uint32_t param_type, unsigned int index)
+{
+	struct tc_ns_operation *operation = &op_params->mb_pack->operation;
+	struct sglist *sglist = NULL;
+	size_t sglist_len;
+
+	if (index >= TEE_PARAM_NUM)
+		return -EINVAL;
+
+	if (import_ion_param(call_params, op_params, kernel_params, index))
+		return -EFAULT;
+
+	sglist_len = tc_dmabuf_sglist_size(&op_params->dmabuf[index]);
+	if (!sglist_len || sglist_len > MAX_SHARED_SIZE) {
+		tloge("invalid ion sglist len %zu\n", sglist_len);
+		return -EINVAL;
+	}
+
+	if (charge_param_mem(call_params, op_params, sglist_len, index))
+		return -ENOMEM;
+
+	sglist = mailbox_alloc(sglist_len, MB_FLAG_WAIT);
+	if (!sglist) {
+		tloge("ion sglist malloc failed, i = %u\n", index);
+		return -ENOMEM;
+	}
+	/* freed with the temp buffers in free_operation */
+	op_params->local_tmpbuf[index].temp_buffer = sglist;
+	op_params->local_tmpbuf[index].size = (unsigned int)sglist_len;
+
+	if (tc_dmabuf_fill_sglist(&op_params->dmabuf[index],
+		sglist, sglist_len))
+		return -EFAULT;
+
+	operation->params[index].memref.buffer = virt_to_phys(sglist);
+	operation->buffer_h_addr[index] =
+		(uint64_t)virt_to_phys(sglist) >> ADDR_TRANS_NUM;
+	operation->params[index].memref.size = (unsigned int)sglist_len;
+	/* TEEC_ION_SGLIST_INPUT equal to TEE_PARAM_TYPE_ION_SGLIST_INPUT */
+	op_params->trans_paramtype[index] = param_type;
+	return 0;
+}
+
+static int alloc_for_ion(const struct tc_call_params *call_params,
+	struct tc_op_params *op_params, uint8_t kernel_params,
+	uint32_t param_type, unsigned int index)
+{
+	struct tc_ns_operation *operation = &op_params->mb_pack->operation;
+	phys_addr_t phys = 0;
+
+	if (index >= TEE_PARAM_NUM)
+		return -EINVAL;
+
+	if (import_ion_param(call_params, op_params, kernel_params, index))
+		return -EFAULT;
+
+	/* only physically contiguous buffer is passed by its address */
+	if (tc_dmabuf_get_phys(&op_params->dmabuf[index], &phys))
+		return -EINVAL;
+
+	operation->params[index].value.a = (unsigned int)phys;
+	operation->params[index].value.b = op_params->dmabuf[index].size;
+	operation->buffer_h_addr[index] = (uint64_t)phys >> ADDR_TRANS_NUM;
+	/* TEEC_ION_INPUT equal to TEE_PARAM_TYPE_ION_INPUT */
+	op_params->trans_paramtype[index] = param_type;
+	return 0;
+}
+#else
 static int alloc_for_ion_sglist(const struct tc_call_params *call_params,
 	struct tc_op_params *op_params, uint8_t kernel_params,
 	uint32_t param_type, unsigned int index)
@@ -580,6 +1068,7 @@ static inline int alloc_for_ion(const struct tc_call_params *call_params,
 	tloge("not support ion and releated feature!\n");
 	return -1;
 }
+#endif
 
 static int alloc_operation(const struct tc_call_params *call_params,
 	struct tc_op_params *op_params)
@@ -590,6 +1079,7 @@ static int alloc_operation(const struct tc_call_params *call_params,
 	uint32_t param_type;
 
 	kernel_params = call_params->dev->kernel_api;
+	snap_client_params(call_params, op_params);
 	for (index = 0; index < TEE_PARAM_NUM; index++) {
 		/*
 		 * Normally kernel_params = kernel_api
@@ -619,6 +1109,11 @@ static int alloc_operation(const struct tc_call_params *call_params,
 		else if (param_type == TEEC_ION_SGLIST_INPUT)
 			ret = alloc_for_ion_sglist(call_params, op_params,
 				kernel_params, param_type, index);
+#ifdef CONFIG_SHARED_MEM_PAGELIST
+		else if (param_type == TEEC_MEMREF_FIXED_INOUT)
+			ret = alloc_for_fixed_mem(call_params, op_params,
+				kernel_params, param_type, index);
+#endif
 		else
 			tlogd("param type = TEEC_NONE\n");
 
@@ -654,17 +1149,18 @@ static int update_tmp_mem(const struct tc_call_params *call_params,
 	buffer_size = operation->params[index].memref.size;
 	client_param = &(call_params->context->params[index]);
 	/* Size is updated all the time */
-	if (write_to_client((void *)(uintptr_t)client_param->memref.size_addr,
-		sizeof(buffer_size),
-		&buffer_size, sizeof(buffer_size),
-		call_params->dev->kernel_api)) {
+	if (write_client_word(call_params, op_params,
+		client_param->memref.size_addr, buffer_size)) {
 		tloge("copy tempbuf size failed\n");
 		return -EFAULT;
 	}
+	/*
+	 * incomplete case (short buffer), only the required size is reported;
+	 * pinned CA pages are written by TEE in place
+	 */
+	if (!is_complete || op_params->local_tmpbuf[index].pages)
+		return 0;
 	if (buffer_size > op_params->local_tmpbuf[index].size) {
-		/* incomplete case, when the buffer size is invalid see next param */
-		if (!is_complete)
-			return 0;
 		/*
 		 * complete case, operation is allocated from mailbox
 		 *  and share with gtask, so it's possible to be changed
@@ -672,12 +1168,13 @@ static int update_tmp_mem(const struct tc_call_params *call_params,
 		tloge("memref.size has been changed larger than the initial\n");
 		return -EFAULT;
 	}
-	/* Only update the buffer when the buffer size is valid in complete case */
+	/*
+	 * Only update the buffer when the buffer size is valid in complete case,
+	 * and only the size returned by TA, use the checked local copy of it
+	 */
 	if (write_to_client((void *)(uintptr_t)client_param->memref.buffer,
-		operation->params[index].memref.size,
-		op_params->local_tmpbuf[index].temp_buffer,
-		operation->params[index].memref.size,
-		call_params->dev->kernel_api)) {
+		buffer_size, op_params->local_tmpbuf[index].temp_buffer,
+		buffer_size, call_params->dev->kernel_api)) {
 		tloge("copy tempbuf failed\n");
 		return -ENOMEM;
 	}
@@ -685,11 +1182,10 @@ static int update_tmp_mem(const struct tc_call_params *call_params,
 }
 
 static int update_for_ref_mem(const struct tc_call_params *call_params,
-	struct tc_op_params *op_params, unsigned int index)
+	struct tc_op_params *op_params, unsigned int index, bool is_complete)
 {
 	union tc_ns_client_param *client_param = NULL;
 	uint32_t buffer_size;
-	unsigned int orig_size = 0;
 	struct tc_ns_operation *operation = &op_params->mb_pack->operation;
 
 	if (index >= TEE_PARAM_NUM) {
@@ -701,24 +1197,19 @@ static int update_for_ref_mem(const struct tc_call_params *call_params,
 	buffer_size = operation->params[index].memref.size;
 	client_param = &(call_params->context->params[index]);
 
-	if (read_from_client(&orig_size,
-		sizeof(orig_size),
-		(uint32_t __user *)(uintptr_t)client_param->memref.size_addr,
-		sizeof(orig_size), call_params->dev->kernel_api)) {
-		tloge("copy orig memref.size_addr failed\n");
-		return -EFAULT;
-	}
-
-	if (write_to_client((void *)(uintptr_t)client_param->memref.size_addr,
-		sizeof(buffer_size),
-		&buffer_size, sizeof(buffer_size),
-		call_params->dev->kernel_api)) {
+	if (write_client_word(call_params, op_params,
+		client_param->memref.size_addr, buffer_size)) {
 		tloge("copy buf size failed\n");
 		return -EFAULT;
 	}
 
-	/* copy from mb_buffer to sharemem */
-	if (operation->mb_buffer[index] && orig_size >= buffer_size) {
+	/*
+	 * copy from mb_buffer to sharemem, only the size returned by TA
+	 * and never beyond the mailbox copy; page list is written in place
+	 */
+	if (is_complete && operation->mb_buffer[index] && buffer_size &&
+		buffer_size <= op_params->local_tmpbuf[index].size &&
+		!is_pagelist_paramtype(op_params->trans_paramtype[index])) {
 		void *buffer_addr =
 			(void *)(uintptr_t)((uintptr_t)
 			operation->sharemem[index]->kernel_addr +
@@ -745,19 +1236,13 @@ static int update_for_value(const struct tc_call_params *call_params,
 		return -EFAULT;
 	}
 	client_param = &(call_params->context->params[index]);
-	if (write_to_client((void *)(uintptr_t)client_param->value.a_addr,
-		sizeof(operation->params[index].value.a),
-		&operation->params[index].value.a,
-		sizeof(operation->params[index].value.a),
-		call_params->dev->kernel_api)) {
+	if (write_client_word(call_params, op_params,
+		client_param->value.a_addr, operation->params[index].value.a)) {
 		tloge("inc copy value.a_addr failed\n");
 		return -EFAULT;
 	}
-	if (write_to_client((void *)(uintptr_t)client_param->value.b_addr,
-		sizeof(operation->params[index].value.b),
-		&operation->params[index].value.b,
-		sizeof(operation->params[index].value.b),
-		call_params->dev->kernel_api)) {
+	if (write_client_word(call_params, op_params,
+		client_param->value.b_addr, operation->params[index].value.b)) {
 		tloge("inc copy value.b_addr failed\n");
 		return -EFAULT;
 	}
@@ -786,14 +1271,20 @@ static int update_client_operation(const struct tc_call_params *call_params,
 				index, is_complete);
 		else if (teec_memref_type(param_type, OUTPUT))
 			ret = update_for_ref_mem(call_params,
-				op_params, index);
+				op_params, index, is_complete);
 		else if (is_complete && teec_value_type(param_type, OUTPUT))
 			ret = update_for_value(call_params, op_params, index);
+#ifdef CONFIG_SHARED_MEM_PAGELIST
+		else if (param_type == TEEC_MEMREF_FIXED_INOUT)
+			ret = update_for_fixed_mem(call_params, op_params, index);
+#endif
 		else
 			tlogd("param_type:%u don't need to update\n", param_type);
 		if (ret)
 			break;
 	}
+	if (flush_client_words(op_params) && !ret)
+		ret = -EFAULT;
 	return ret;
 }
 
@@ -809,7 +1300,10 @@ static void free_operation(const struct tc_call_params *call_params,
 	for (index = 0; index < TEE_PARAM_NUM; index++) {
 		param_type = teec_param_type_get(
 			call_params->context->param_types, index);
-		if (is_tmp_mem(param_type)) {
+		if (is_tmp_mem(param_type) && local_tmpbuf[index].pages) {
+			tc_mem_unpin_user_buf(&local_tmpbuf[index],
+				param_type != TEEC_MEMREF_TEMP_INPUT);
+		} else if (is_tmp_mem(param_type)) {
 			/* free temp buffer */
 			temp_buf = local_tmpbuf[index].temp_buffer;
 			tlogd("free temp buf, i = %u\n", index);
@@ -834,6 +1328,13 @@ static void free_operation(const struct tc_call_params *call_params,
 				temp_buf = NULL;
 			}
 		}
+		if (is_ion_param(param_type))
+			tc_dmabuf_release(&op_params->dmabuf[index]);
+		uncharge_param_mem(call_params, op_params, index);
+#ifdef CONFIG_SHARED_MEM_PAGELIST
+		tc_mem_fixed_buf_put(op_params->fixed_buf[index]);
+		op_params->fixed_buf[index] = NULL;
+#endif
 	}
 }
 
@@ -857,8 +1358,85 @@ static int is_clicall_params_vaild(const struct tc_call_params *call_params)
 	return true;
 }
 
-static int alloc_for_client_call(struct tc_op_params *op_params)
+static atomic_t g_invoke_ctx_bytes = ATOMIC_INIT(0);
+
+static bool is_invoke_ctx_call(const struct tc_call_params *call_params)
+{
+	return call_params->sess && !(call_params->flags & TC_CALL_GLOBAL);
+}
+
+/*
+ * invokes of one session are serialized by ta_session_lock, so they
+ * can share one smc_cmd and mb_pack, allocated at the first invoke
+ */
+static int get_session_invoke_ctx(struct tc_ns_session *sess,
+	struct tc_op_params *op_params)
+{
+	struct tc_ns_smc_cmd *smc_cmd = sess->invoke_cmd;
+
+	if (smc_cmd) {
+		/* keep uuid, cmd_type, dev_file_id and context_id */
+		(void)memset_s(&smc_cmd->agent_id, sizeof(*smc_cmd) -
+			offsetof(struct tc_ns_smc_cmd, agent_id), 0,
+			sizeof(*smc_cmd) - offsetof(struct tc_ns_smc_cmd, agent_id));
+		(void)memset_s(&sess->invoke_pack->operation,
+			sizeof(sess->invoke_pack->operation), 0,
+			sizeof(sess->invoke_pack->operation));
+		goto out;
+	}
+
+	/* do not keep more of the pool while others wait for it */
+	if (mailbox_has_waiters())
+		return -EBUSY;
+
+	if (atomic_add_return(INVOKE_CTX_PACK_SIZE, &g_invoke_ctx_bytes) >
+		MAX_INVOKE_CTX_BYTES) {
+		atomic_sub(INVOKE_CTX_PACK_SIZE, &g_invoke_ctx_bytes);
+		return -ENOSPC;
+	}
+
+	smc_cmd = kzalloc(sizeof(*smc_cmd), GFP_KERNEL);
+	if (ZERO_OR_NULL_PTR((unsigned long)(uintptr_t)smc_cmd)) {
+		atomic_sub(INVOKE_CTX_PACK_SIZE, &g_invoke_ctx_bytes);
+		return -ENOMEM;
+	}
+
+	sess->invoke_pack = mailbox_alloc_cmd_pack();
+	if (!sess->invoke_pack) {
+		kfree(smc_cmd);
+		atomic_sub(INVOKE_CTX_PACK_SIZE, &g_invoke_ctx_bytes);
+		return -ENOMEM;
+	}
+	sess->invoke_cmd = smc_cmd;
+	sess->invoke_cmd_inited = false;
+out:
+	op_params->smc_cmd = sess->invoke_cmd;
+	op_params->mb_pack = sess->invoke_pack;
+	op_params->cached_ctx = true;
+	return 0;
+}
+
+void free_session_invoke_ctx(struct tc_ns_session *session)
+{
+	if (!session || !session->invoke_cmd)
+		return;
+
+	kfree(session->invoke_cmd);
+	session->invoke_cmd = NULL;
+	mailbox_free(session->invoke_pack);
+	session->invoke_pack = NULL;
+	session->invoke_cmd_inited = false;
+	atomic_sub(INVOKE_CTX_PACK_SIZE, &g_invoke_ctx_bytes);
+}
+
+static int alloc_for_client_call(const struct tc_call_params *call_params,
+	struct tc_op_params *op_params)
 {
+	/* fall back to per call alloc when too many ctx are cached */
+	if (is_invoke_ctx_call(call_params) &&
+		!get_session_invoke_ctx(call_params->sess, op_params))
+		return 0;
+
 	op_params->smc_cmd = kzalloc(sizeof(*(op_params->smc_cmd)),
 		GFP_KERNEL);
 	if (ZERO_OR_NULL_PTR((unsigned long)(uintptr_t)(op_params->smc_cmd))) {
@@ -884,15 +1462,19 @@ static int init_smc_cmd(const struct tc_call_params *call_params,
 	struct tc_ns_operation *operation = &op_params->mb_pack->operation;
 	bool global = call_params->flags & TC_CALL_GLOBAL;
 
-	smc_cmd->cmd_type = global ? CMD_TYPE_GLOBAL : CMD_TYPE_TA;
-	if (memcpy_s(smc_cmd->uuid, sizeof(smc_cmd->uuid),
-		context->uuid, UUID_LEN)) {
-		tloge("memcpy uuid error\n");
-		return -EFAULT;
-	}
 	smc_cmd->cmd_id = context->cmd_id;
-	smc_cmd->dev_file_id = call_params->dev->dev_file_id;
-	smc_cmd->context_id = context->session_id;
+	if (!op_params->cached_ctx || !call_params->sess->invoke_cmd_inited) {
+		smc_cmd->cmd_type = global ? CMD_TYPE_GLOBAL : CMD_TYPE_TA;
+		if (memcpy_s(smc_cmd->uuid, sizeof(smc_cmd->uuid),
+			context->uuid, UUID_LEN)) {
+			tloge("memcpy uuid error\n");
+			return -EFAULT;
+		}
+		smc_cmd->dev_file_id = call_params->dev->dev_file_id;
+		smc_cmd->context_id = context->session_id;
+		if (op_params->cached_ctx)
+			call_params->sess->invoke_cmd_inited = true;
+	}
 	smc_cmd->err_origin = context->returns.origin;
 	smc_cmd->started = context->started;
 	smc_cmd->ca_pid = current->pid;
@@ -1020,6 +1602,12 @@ static void release_tc_call_resource(const struct tc_call_params *call_params,
 	if (op_params->op_inited)
 		free_operation(call_params, op_params);
 
+	if (op_params->cached_ctx) {
+		/* give the pack back to the pool while others wait for it */
+		if (mailbox_has_waiters())
+			free_session_invoke_ctx(call_params->sess);
+		return;
+	}
 	kfree(op_params->smc_cmd);
 	mailbox_free(op_params->mb_pack);
 }
@@ -1060,7 +1648,8 @@ static int handle_ta_pending(const struct tc_call_params *call_params,
 			return ret;
 		}
 
-		*tee_ret = tc_ns_smc_with_no_nr(op_params->smc_cmd);
+		*tee_ret = tc_ns_session_smc(op_params->smc_cmd,
+			call_params->sess, true);
 		ret = post_process_token(call_params, op_params);
 		if (ret) {
 			tloge("no nr smc post proc token failed\n");
@@ -1087,7 +1676,7 @@ static int post_proc_smc_return(const struct tc_call_params *call_params,
 		if (tee_ret == TEEC_ERROR_SHORT_BUFFER)
 			(void)update_client_operation(call_params, op_params, false);
 	} else {
-		tz_log_write();
+		tz_log_update();
 		ret = update_client_operation(call_params, op_params, true);
 	}
 
@@ -1098,12 +1687,14 @@ int tc_client_call(const struct tc_call_params *call_params)
 {
 	int ret;
 	int tee_ret = 0;
-	struct tc_op_params op_params = { NULL, NULL, {{0}}, {0}, false };
+	struct tc_op_params op_params = {
+		NULL, NULL, {{0}}, {0}, {0}, {NULL}, false, false, {0}
+	};
 
 	if (!is_clicall_params_vaild(call_params))
 		return -EINVAL;
 
-	if (alloc_for_client_call(&op_params))
+	if (alloc_for_client_call(call_params, &op_params))
 		return -ENOMEM;
 
 	op_params.smc_cmd->err_origin = TEEC_ORIGIN_COMMS;
@@ -1118,7 +1709,8 @@ int tc_client_call(const struct tc_call_params *call_params)
 	if (ret)
 		goto free_src;
 
-	tee_ret = tc_ns_smc(op_params.smc_cmd);
+	tee_ret = tc_ns_session_smc(op_params.smc_cmd,
+		call_params->sess, false);
 
 	reset_session_id(call_params, &op_params, tee_ret);
 
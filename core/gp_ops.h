@@ -17,8 +17,10 @@
  */
 #ifndef GP_OPS_H
 #define GP_OPS_H
+#include <linux/bitmap.h>
 #include "tc_ns_client.h"
 #include "teek_ns_client.h"
+#include "dmabuf_mem.h"
 
 struct tc_call_params {
 	struct tc_ns_dev_file *dev;
@@ -27,12 +29,27 @@ struct tc_call_params {
 	uint8_t flags;
 };
 
+#define PARAM_SNAP_SIZE 128
+
+/* one user copy of the value and size fields of all params */
+struct tc_param_snap {
+	uint64_t base;
+	uint32_t len;
+	DECLARE_BITMAP(dirty, PARAM_SNAP_SIZE); /* bytes written by kernel */
+	uint8_t data[PARAM_SNAP_SIZE];
+};
+
 struct tc_op_params {
 	struct mb_cmd_pack *mb_pack;
 	struct tc_ns_smc_cmd *smc_cmd;
 	struct tc_ns_temp_buf local_tmpbuf[TEE_PARAM_NUM];
 	uint32_t trans_paramtype[TEE_PARAM_NUM];
+	uint32_t mb_charged[TEE_PARAM_NUM]; /* size charged to dev mb_usage */
+	struct tc_ns_fixed_buf *fixed_buf[TEE_PARAM_NUM];
 	bool op_inited;
+	bool cached_ctx; /* smc_cmd and mb_pack belong to the session */
+	struct tc_param_snap param_snap;
+	struct tc_ns_dmabuf dmabuf[TEE_PARAM_NUM];
 };
 
 int write_to_client(void __user *dest, size_t dest_size,
@@ -42,6 +59,7 @@ int read_from_client(void *dest, size_t dest_size,
 bool tc_user_param_valid(struct tc_ns_client_context *client_context,
 	unsigned int index);
 int tc_client_call(const struct tc_call_params *call_params);
+void free_session_invoke_ctx(struct tc_ns_session *session);
 bool is_tmp_mem(uint32_t param_type);
 bool is_ref_mem(uint32_t param_type);
 bool is_val_param(uint32_t param_type);
@@ -24,6 +24,9 @@
 #include <linux/debugfs.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/atomic.h>
+#include <linux/jiffies.h>
 #include <linux/uaccess.h>
 #include <linux/version.h>
 #include <securec.h>
@@ -34,6 +37,7 @@
 #include "tc_ns_log.h"
 #include "smc_smp.h"
 #include "ko_adapt.h"
+#include "tc_client_driver.h"
 
 #define MAILBOX_PAGE_MAX (MAILBOX_POOL_SIZE >> PAGE_SHIFT)
 static int g_max_oder;
@@ -62,6 +66,40 @@ struct mb_zone_t {
 static struct mb_zone_t *g_m_zone;
 static struct mutex g_mb_lock;
 
+/*
+ * waiters of MB_FLAG_WAIT are queued in FIFO order, only the head of
+ * g_mb_waiters may take pages, so a big request can not be starved
+ * by the smaller ones coming after it
+ */
+struct mb_waiter_t {
+	struct list_head node;
+	int order;
+};
+
+struct mb_wait_stat_t {
+	uint64_t wait_cnt;
+	uint64_t timeout_cnt;
+	uint64_t wait_time_ms;
+	uint32_t max_wait_ms;
+};
+
+/* staging region for TA loading, carved from the pool at init */
+static void *g_mb_load_mem;
+static unsigned int g_mb_load_size;
+static atomic_t g_mb_load_busy = ATOMIC_INIT(0);
+
+/*
+ * per dev file limit, set at init from the pool left after the load
+ * reserve, can be changed by debugfs tz_mailbox/dev_limit
+ */
+static u32 g_mb_dev_limit;
+static atomic_t g_mb_limit_hit = ATOMIC_INIT(0);
+
+static LIST_HEAD(g_mb_waiters);
+static DECLARE_WAIT_QUEUE_HEAD(g_mb_wait_queue);
+static unsigned int g_mb_wake_gen;
+static struct mb_wait_stat_t g_mb_wait_stat;
+
 static void mailbox_show_status(void)
 {
 	unsigned int i;
@@ -85,6 +123,11 @@ static void mailbox_show_status(void)
 		}
 	}
 	tloge("total usage:%u/%u\n", used, MAILBOX_PAGE_MAX);
+	tloge("wait count:%llu, timeout count:%llu, wait time:%llums, max wait:%ums\n",
+		g_mb_wait_stat.wait_cnt, g_mb_wait_stat.timeout_cnt,
+		g_mb_wait_stat.wait_time_ms, g_mb_wait_stat.max_wait_ms);
+	tloge("dev limit:%u, limit hit count:%d\n", g_mb_dev_limit,
+		atomic_read(&g_mb_limit_hit));
 	tloge("----------------------------------------\n");
 
 	for (i = 0; i < (unsigned int)g_max_oder; i++) {
@@ -143,26 +186,17 @@ static void mailbox_show_details(void)
 	mutex_unlock(&g_mb_lock);
 }
 
-void *mailbox_alloc(size_t size, unsigned int flag)
+/*
+ * must be called with g_mb_lock held, only free blocks below
+ * max_order are split, so blocks others wait for can be left alone
+ */
+static void *mb_alloc_below_locked(int order, int max_order)
 {
 	unsigned int i;
 	struct mb_page_t *pos = (struct mb_page_t *)NULL;
 	struct list_head *head = NULL;
-	int order = get_order(ALIGN(size, SZ_4K));
-	void *addr = NULL;
 
-	if (!size || !g_m_zone) {
-		tlogw("alloc 0 size mailbox or zone struct is NULL\n");
-		return NULL;
-	}
-
-	if (order > g_max_oder || order < 0) {
-		tloge("invalid order %d\n", order);
-		return NULL;
-	}
-
-	mutex_lock(&g_mb_lock);
-	for (i = (unsigned int)order; i <= (unsigned int)g_max_oder; i++) {
+	for (i = (unsigned int)order; i < (unsigned int)max_order; i++) {
 		unsigned int j;
 
 		head = &g_m_zone->free_areas[i].page_list;
@@ -185,9 +219,123 @@ void *mailbox_alloc(size_t size, unsigned int flag)
 				&g_m_zone->free_areas[j].page_list);
 		}
 		list_del(&pos->node);
-		addr = page_address(pos->page);
-		break;
+		return page_address(pos->page);
+	}
+
+	return NULL;
+}
+
+/* must be called with g_mb_lock held */
+static void *mb_alloc_locked(int order)
+{
+	return mb_alloc_below_locked(order, g_max_oder + 1);
+}
+
+/*
+ * must be called with g_mb_lock held, a caller that does not wait must
+ * not take a block the first waiter could use, it only gets smaller ones
+ */
+static void *mb_alloc_nowait_locked(int order)
+{
+	const struct mb_waiter_t *first = NULL;
+
+	if (list_empty(&g_mb_waiters))
+		return mb_alloc_locked(order);
+
+	first = list_first_entry(&g_mb_waiters, struct mb_waiter_t, node);
+	return mb_alloc_below_locked(order, first->order);
+}
+
+/* must be called with g_mb_lock held, let waiters recheck the pool */
+static void mb_wake_waiters_locked(void)
+{
+	if (list_empty(&g_mb_waiters))
+		return;
+
+	g_mb_wake_gen++;
+	wake_up_interruptible_all(&g_mb_wait_queue);
+}
+
+static void mb_update_wait_stat(unsigned long start, bool is_timeout)
+{
+	unsigned int cost = jiffies_to_msecs(jiffies - start);
+
+	g_mb_wait_stat.wait_cnt++;
+	g_mb_wait_stat.wait_time_ms += cost;
+	if (cost > g_mb_wait_stat.max_wait_ms)
+		g_mb_wait_stat.max_wait_ms = cost;
+	if (is_timeout)
+		g_mb_wait_stat.timeout_cnt++;
+}
+
+/* must be called with g_mb_lock held, return with g_mb_lock held */
+static void *mb_alloc_wait_locked(int order)
+{
+	struct mb_waiter_t waiter;
+	unsigned long start = jiffies;
+	long left = (long)msecs_to_jiffies(MB_WAIT_TIMEOUT_MS);
+	unsigned int gen;
+	void *addr = NULL;
+
+	INIT_LIST_HEAD(&waiter.node);
+	waiter.order = order;
+	list_add_tail(&waiter.node, &g_mb_waiters);
+
+	for (;;) {
+		if (list_first_entry(&g_mb_waiters,
+			struct mb_waiter_t, node) == &waiter) {
+			addr = mb_alloc_locked(order);
+			if (addr)
+				break;
+		}
+
+		if (left <= 0)
+			break;
+
+		gen = g_mb_wake_gen;
+		mutex_unlock(&g_mb_lock);
+		left = wait_event_interruptible_timeout(g_mb_wait_queue,
+			READ_ONCE(g_mb_wake_gen) != gen, left);
+		mutex_lock(&g_mb_lock);
+		if (left < 0) {
+			tlogw("wait for mailbox is interrupted\n");
+			break;
+		}
+	}
+
+	list_del(&waiter.node);
+	mb_update_wait_stat(start, (!addr && left == 0));
+	if (!addr && left == 0)
+		tloge("wait for mailbox order %d timeout\n", order);
+
+	/* head of queue changed, the next one should have a try */
+	mb_wake_waiters_locked();
+	return addr;
+}
+
+void *mailbox_alloc(size_t size, unsigned int flag)
+{
+	int order = get_order(ALIGN(size, SZ_4K));
+	void *addr = NULL;
+
+	if (!size || !g_m_zone) {
+		tlogw("alloc 0 size mailbox or zone struct is NULL\n");
+		return NULL;
 	}
+
+	if (order > g_max_oder || order < 0) {
+		tloge("invalid order %d\n", order);
+		return NULL;
+	}
+
+	mutex_lock(&g_mb_lock);
+	/* queued waiters go first, a new caller must not jump ahead of them */
+	if (!(flag & MB_FLAG_WAIT))
+		addr = mb_alloc_nowait_locked(order);
+	else if (list_empty(&g_mb_waiters))
+		addr = mb_alloc_locked(order);
+	if (!addr && (flag & MB_FLAG_WAIT))
+		addr = mb_alloc_wait_locked(order);
 	mutex_unlock(&g_mb_lock);
 
 	if (addr && (flag & MB_FLAG_ZERO)) {
@@ -282,15 +430,23 @@ void mailbox_free(const void *ptr)
 			/* release self */
 			list_add_tail(&self->node,
 				&g_m_zone->free_areas[i].page_list);
+			mb_wake_waiters_locked();
 			mutex_unlock(&g_mb_lock);
 			return;
 		}
 	}
 
 	add_max_order_block(i);
+	mb_wake_waiters_locked();
 	mutex_unlock(&g_mb_lock);
 }
 
+/* someone is sleeping for the pool, cached mailbox should be given back */
+bool mailbox_has_waiters(void)
+{
+	return !list_empty_careful(&g_mb_waiters);
+}
+
 struct mb_cmd_pack *mailbox_alloc_cmd_pack(void)
 {
 	void *pack = mailbox_alloc(SZ_4K, MB_FLAG_ZERO);
@@ -325,6 +481,109 @@ void *mailbox_copy_alloc(const void *src, size_t size)
 	return mb_ptr;
 }
 
+/* bytes really taken from the pool by a request of size */
+static size_t mb_charge_size(size_t size)
+{
+	return PAGE_SIZE << (unsigned int)get_order(ALIGN(size, SZ_4K));
+}
+
+/*
+ * charge size to usage before alloc mailbox on behalf of a client,
+ * so one client can not exhaust the pool shared by all of them
+ */
+int mailbox_charge(atomic_t *usage, size_t size)
+{
+	size_t charge;
+	u32 limit = READ_ONCE(g_mb_dev_limit);
+
+	if (!usage || !size)
+		return -EINVAL;
+
+	if (size > MAILBOX_POOL_SIZE) {
+		tloge("charge size %zu is too large\n", size);
+		return -ENOMEM;
+	}
+
+	charge = mb_charge_size(size);
+	if ((u32)atomic_add_return((int)charge, usage) > limit) {
+		atomic_sub((int)charge, usage);
+		atomic_inc(&g_mb_limit_hit);
+		tloge("refuse mailbox of %zu bytes, dev file holds %d and "
+			"dev limit is %u (pool %u, load reserve %u)\n", size,
+			atomic_read(usage), limit, MAILBOX_POOL_SIZE,
+			g_mb_load_size);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+void mailbox_uncharge(atomic_t *usage, size_t size)
+{
+	if (!usage || !size || size > MAILBOX_POOL_SIZE)
+		return;
+
+	atomic_sub((int)mb_charge_size(size), usage);
+}
+
+/*
+ * take the reserved load region, return NULL if it is not configured
+ * or it is being used by another loader, caller should fall back to
+ * mailbox_alloc in that case
+ */
+void *mailbox_load_mem_get(unsigned int *size)
+{
+	if (!size || !g_mb_load_mem)
+		return NULL;
+
+	if (atomic_cmpxchg(&g_mb_load_busy, 0, 1) != 0)
+		return NULL;
+
+	*size = g_mb_load_size;
+	return g_mb_load_mem;
+}
+
+void mailbox_load_mem_put(const void *ptr)
+{
+	if (!ptr || ptr != g_mb_load_mem) {
+		tloge("invalid load mem to put\n");
+		return;
+	}
+
+	atomic_set(&g_mb_load_busy, 0);
+}
+
+static void mailbox_load_mem_init(void)
+{
+	unsigned int size;
+
+	if (CONFIG_MAILBOX_LOAD_RESERVE_ORDER <= 0 ||
+		CONFIG_MAILBOX_LOAD_RESERVE_ORDER >= g_max_oder) {
+		tlogi("no reserved mailbox for TA loading\n");
+		return;
+	}
+
+	size = PAGE_SIZE << CONFIG_MAILBOX_LOAD_RESERVE_ORDER;
+	g_mb_load_mem = mailbox_alloc(size, 0);
+	if (!g_mb_load_mem) {
+		tloge("reserve mailbox for TA loading failed\n");
+		return;
+	}
+	g_mb_load_size = size;
+}
+
+static void mailbox_dev_limit_init(void)
+{
+	u32 left = MAILBOX_POOL_SIZE - g_mb_load_size;
+
+	/* one client may hold 3/4 of what loads leave, the rest is others' */
+	if (CONFIG_MAILBOX_DEV_LIMIT > 0)
+		g_mb_dev_limit = min_t(u32, CONFIG_MAILBOX_DEV_LIMIT, left);
+	else
+		g_mb_dev_limit = left - left / 4;
+	tlogi("mailbox dev limit is %u\n", g_mb_dev_limit);
+}
+
 struct mb_dbg_entry {
 	struct list_head node;
 	unsigned int idx;
@@ -505,6 +764,7 @@ static ssize_t mb_dbg_state_read(struct file *filp, char __user *ubuf,
 	(void)(ppos);
 	mailbox_show_status();
 	mailbox_show_details();
+	dump_dev_mailbox_usage();
 	return 0;
 }
 
@@ -565,6 +825,7 @@ static void mailbox_debug_init(void)
 	debugfs_create_file("opt", OPT_MODE, g_mb_dbg_dentry, NULL, &g_mb_dbg_opt_fops);
 #endif
 	debugfs_create_file("state", STATE_MODE, g_mb_dbg_dentry, NULL, &g_mb_dbg_state_fops);
+	debugfs_create_u32("dev_limit", OPT_MODE, g_mb_dbg_dentry, &g_mb_dev_limit);
 }
 
 int mailbox_mempool_init(void)
@@ -620,12 +881,16 @@ int mailbox_mempool_init(void)
 	list_add_tail(&mb_page->node, &area->page_list);
 	g_m_zone->all_pages = all_pages;
 	mutex_init(&g_mb_lock);
+	mailbox_load_mem_init();
+	mailbox_dev_limit_init();
 	mailbox_debug_init();
 	return 0;
 }
 
 void mailbox_mempool_destroy(void)
 {
+	g_mb_load_mem = NULL;
+	g_mb_load_size = 0;
 	__free_pages(g_m_zone->all_pages, g_max_oder);
 	g_m_zone->all_pages = NULL;
 	kfree(g_m_zone);
@@ -20,18 +20,42 @@
 
 #include <linux/kernel.h>
 #include <linux/types.h>
+#include <linux/atomic.h>
 
 #define MAILBOX_POOL_SIZE SZ_4M
 
 /* alloc options */
 #define MB_FLAG_ZERO 0x1 /* set 0 after alloc page */
+#define MB_FLAG_WAIT 0x2 /* sleep in FIFO order until pool has room */
+#define MB_WAIT_TIMEOUT_MS 3000U /* max time to sleep with MB_FLAG_WAIT */
+
+/*
+ * limit of mailbox bytes one dev file can hold for its params,
+ * 0 derives it from the pool left after the load reserve
+ */
+#ifndef CONFIG_MAILBOX_DEV_LIMIT
+#define CONFIG_MAILBOX_DEV_LIMIT 0
+#endif
 #define GLOBAL_UUID_LEN 17 /* first char represent global cmd */
 
+/*
+ * order of the mailbox region reserved for secure image loading,
+ * 0 means no reserved region and TA loading shares the buddy pool
+ */
+#ifndef CONFIG_MAILBOX_LOAD_RESERVE_ORDER
+#define CONFIG_MAILBOX_LOAD_RESERVE_ORDER 8
+#endif
+
 void *mailbox_alloc(size_t size, unsigned int flag);
 void mailbox_free(const void *ptr);
 int mailbox_mempool_init(void);
 void mailbox_mempool_destroy(void);
 struct mb_cmd_pack *mailbox_alloc_cmd_pack(void);
+bool mailbox_has_waiters(void);
 void *mailbox_copy_alloc(const void *src, size_t size);
+int mailbox_charge(atomic_t *usage, size_t size);
+void mailbox_uncharge(atomic_t *usage, size_t size);
+void *mailbox_load_mem_get(unsigned int *size);
+void mailbox_load_mem_put(const void *ptr);
 
 #endif
@@ -26,7 +26,14 @@
 #include <linux/mempool.h>
 #include <linux/vmalloc.h>
 #include <linux/of_reserved_mem.h>
+#include <linux/version.h>
+#include <linux/capability.h>
+#if (KERNEL_VERSION(4, 14, 0) <= LINUX_VERSION_CODE)
+#include <linux/sched/mm.h>
+#include <linux/sched/signal.h>
+#endif
 #include <securec.h>
+#include "teek_client_constants.h"
 #include "smc_smp.h"
 #include "tc_ns_client.h"
 #include "teek_ns_client.h"
@@ -43,9 +50,516 @@ void tc_mem_free(struct tc_ns_shared_mem *shared_mem)
 		vfree(shared_mem->kernel_addr);
 		shared_mem->kernel_addr = NULL;
 	}
-	kfree(shared_mem);
+	/* tc_mem_find_get may still be looking at it under rcu */
+	kfree_rcu(shared_mem, rcu);
 }
 
+static inline unsigned long shm_addr_key(const void *user_addr)
+{
+	return (unsigned long)(uintptr_t)user_addr >> PAGE_SHIFT;
+}
+
+/* must be called with dev_file->shared_mem_lock held */
+int tc_mem_index_add(struct tc_ns_dev_file *dev_file,
+	struct tc_ns_shared_mem *shared_mem, const void *user_addr)
+{
+	int ret;
+
+	if (!dev_file || !shared_mem || user_addr == INVALID_MAP_ADDR)
+		return -EINVAL;
+
+	ret = radix_tree_insert(&dev_file->shm_addr_tree,
+		shm_addr_key(user_addr), shared_mem);
+	if (ret)
+		tloge("index sharemem failed, ret=%d\n", ret);
+
+	return ret;
+}
+
+/* must be called with dev_file->shared_mem_lock held */
+struct tc_ns_shared_mem *tc_mem_index_del(struct tc_ns_dev_file *dev_file,
+	const void *user_addr)
+{
+	if (!dev_file || user_addr == INVALID_MAP_ADDR)
+		return NULL;
+
+	return radix_tree_delete(&dev_file->shm_addr_tree,
+		shm_addr_key(user_addr));
+}
+
+/*
+ * find the sharemem mapped by CA at user_addr, without the
+ * shared_mem_lock, caller must put_sharemem_struct when done
+ */
+struct tc_ns_shared_mem *tc_mem_find_get(struct tc_ns_dev_file *dev_file,
+	const void *user_addr)
+{
+	struct tc_ns_shared_mem *shared_mem = NULL;
+
+	if (!dev_file || !user_addr || user_addr == INVALID_MAP_ADDR)
+		return NULL;
+
+	rcu_read_lock();
+	shared_mem = radix_tree_lookup(&dev_file->shm_addr_tree,
+		shm_addr_key(user_addr));
+	if (shared_mem && !atomic_inc_not_zero(&shared_mem->usage))
+		shared_mem = NULL;
+	rcu_read_unlock();
+
+	/* it may be unmapped between lookup and get */
+	if (shared_mem && READ_ONCE(shared_mem->user_addr) != user_addr) {
+		put_sharemem_struct(shared_mem);
+		shared_mem = NULL;
+	}
+
+	return shared_mem;
+}
+
+#ifdef CONFIG_SHARED_MEM_PAGELIST
+static uint32_t pagelist_page_num(uint32_t offset, uint32_t size)
+{
+	uint64_t start = (uint64_t)offset & PAGE_MASK;
+	uint64_t end = PAGE_ALIGN((uint64_t)offset + size);
+
+	return (uint32_t)((end - start) >> PAGE_SHIFT);
+}
+
+size_t tc_mem_pagelist_size(uint32_t offset, uint32_t size)
+{
+	return sizeof(struct pagelist_info) +
+		sizeof(uint64_t) * pagelist_page_num(offset, size);
+}
+
+/* caller must make sure [offset, offset + size) is inside shared_mem */
+int tc_mem_fill_pagelist(const struct tc_ns_shared_mem *shared_mem,
+	uint32_t offset, uint32_t size, struct pagelist_info *info,
+	size_t info_len)
+{
+	uint32_t i;
+	uint32_t page_num = pagelist_page_num(offset, size);
+	char *start = NULL;
+	struct page *page = NULL;
+
+	if (!shared_mem || !shared_mem->kernel_addr || !info || !size) {
+		tloge("invalid params to fill pagelist\n");
+		return -EINVAL;
+	}
+
+	if (info_len < tc_mem_pagelist_size(offset, size)) {
+		tloge("pagelist buffer is too small\n");
+		return -EINVAL;
+	}
+
+	start = (char *)shared_mem->kernel_addr + (offset & PAGE_MASK);
+	for (i = 0; i < page_num; i++) {
+		page = vmalloc_to_page(start + ((size_t)i << PAGE_SHIFT));
+		if (!page) {
+			tloge("get sharemem page %u failed\n", i);
+			return -EFAULT;
+		}
+		info->phys_addr[i] = (uint64_t)page_to_phys(page);
+	}
+	info->page_num = page_num;
+	info->page_size = PAGE_SIZE;
+	info->sharedmem_offset = offset_in_page(offset);
+	info->sharedmem_size = size;
+	return 0;
+}
+
+static int pin_user_buf_pages(unsigned long start, int nr_pages, bool write,
+	bool longterm, struct page **pages)
+{
+#if (KERNEL_VERSION(5, 2, 0) <= LINUX_VERSION_CODE)
+	unsigned int flags = write ? FOLL_WRITE : 0;
+
+	/* a long term pin must not hold movable or CMA pages */
+	if (longterm)
+		flags |= FOLL_LONGTERM;
+#if (KERNEL_VERSION(5, 6, 0) <= LINUX_VERSION_CODE)
+	return pin_user_pages_fast(start, nr_pages, flags, pages);
+#else
+	return get_user_pages_fast(start, nr_pages, flags, pages);
+#endif
+#else
+	(void)longterm;
+	return get_user_pages_fast(start, nr_pages, write ? 1 : 0, pages);
+#endif
+}
+
+static void unpin_user_buf_pages(struct page **pages, unsigned int nr_pages,
+	bool dirty)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_pages; i++) {
+		if (dirty)
+			set_page_dirty_lock(pages[i]);
+#if (KERNEL_VERSION(5, 6, 0) <= LINUX_VERSION_CODE)
+		unpin_user_page(pages[i]);
+#else
+		put_page(pages[i]);
+#endif
+	}
+}
+
+static int pin_user_buf(const void __user *user_addr, uint32_t size,
+	bool write, bool longterm, struct tc_ns_temp_buf *buf)
+{
+	unsigned long start = (uintptr_t)user_addr & PAGE_MASK;
+	uint32_t offset = offset_in_page((uintptr_t)user_addr);
+	uint32_t page_num = pagelist_page_num(offset, size);
+	struct pagelist_info *info = NULL;
+	struct page **pages = NULL;
+	int pinned;
+	uint32_t i;
+
+	if (!user_addr || !size || !buf)
+		return -EINVAL;
+
+	pages = vzalloc(sizeof(*pages) * page_num);
+	if (!pages) {
+		tloge("alloc pages array failed\n");
+		return -ENOMEM;
+	}
+
+	pinned = pin_user_buf_pages(start, (int)page_num, write, longterm,
+		pages);
+	if (pinned != (int)page_num) {
+		tloge("pin user buf failed, %d/%u\n", pinned, page_num);
+		if (pinned > 0)
+			unpin_user_buf_pages(pages, (unsigned int)pinned, false);
+		vfree(pages);
+		return -EFAULT;
+	}
+
+	info = mailbox_alloc(tc_mem_pagelist_size(offset, size), MB_FLAG_WAIT);
+	if (!info) {
+		unpin_user_buf_pages(pages, page_num, false);
+		vfree(pages);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < page_num; i++)
+		info->phys_addr[i] = (uint64_t)page_to_phys(pages[i]);
+	info->page_num = page_num;
+	info->page_size = PAGE_SIZE;
+	info->sharedmem_offset = offset;
+	info->sharedmem_size = size;
+
+	buf->temp_buffer = info;
+	buf->size = size;
+	buf->pages = pages;
+	buf->page_num = page_num;
+	return 0;
+}
+
+/*
+ * pin the CA buffer and describe it to TEE by a page list in mailbox,
+ * so large temp buffers are passed without copy; the page list is
+ * returned in buf->temp_buffer, release all by tc_mem_unpin_user_buf
+ */
+int tc_mem_pin_user_buf(const void __user *user_addr, uint32_t size,
+	bool write, struct tc_ns_temp_buf *buf)
+{
+	return pin_user_buf(user_addr, size, write, false, buf);
+}
+
+void tc_mem_unpin_user_buf(struct tc_ns_temp_buf *buf, bool dirty)
+{
+	if (!buf || !buf->pages)
+		return;
+
+	unpin_user_buf_pages(buf->pages, buf->page_num, dirty);
+	vfree(buf->pages);
+	buf->pages = NULL;
+	buf->page_num = 0;
+	if (buf->temp_buffer) {
+		mailbox_free(buf->temp_buffer);
+		buf->temp_buffer = NULL;
+	}
+}
+
+#if (KERNEL_VERSION(4, 11, 0) > LINUX_VERSION_CODE)
+static inline void mmgrab(struct mm_struct *mm)
+{
+	atomic_inc(&mm->mm_count);
+}
+#endif
+
+/* fixed bufs stay pinned, charge them to RLIMIT_MEMLOCK as RDMA does */
+static int charge_pinned_vm(struct mm_struct *mm, unsigned long pages)
+{
+	unsigned long limit = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+	int ret = 0;
+
+#if (KERNEL_VERSION(5, 1, 0) <= LINUX_VERSION_CODE)
+	if ((unsigned long)atomic64_add_return((s64)pages, &mm->pinned_vm) >
+		limit && !capable(CAP_IPC_LOCK)) {
+		atomic64_sub((s64)pages, &mm->pinned_vm);
+		ret = -ENOMEM;
+	}
+#else
+	down_write(&mm->mmap_sem);
+	if (mm->pinned_vm + pages > limit && !capable(CAP_IPC_LOCK))
+		ret = -ENOMEM;
+	else
+		mm->pinned_vm += pages;
+	up_write(&mm->mmap_sem);
+#endif
+	if (ret)
+		tloge("pin %lu pages over RLIMIT_MEMLOCK\n", pages);
+	return ret;
+}
+
+static void uncharge_pinned_vm(struct mm_struct *mm, unsigned long pages)
+{
+#if (KERNEL_VERSION(5, 1, 0) <= LINUX_VERSION_CODE)
+	atomic64_sub((s64)pages, &mm->pinned_vm);
+#else
+	down_write(&mm->mmap_sem);
+	mm->pinned_vm -= pages;
+	up_write(&mm->mmap_sem);
+#endif
+}
+
+static int send_fixed_buf_cmd(unsigned int dev_file_id, uint32_t cmd_id,
+	const struct tc_ns_temp_buf *buf, uint32_t *tee_handle)
+{
+	struct tc_ns_smc_cmd smc_cmd = { {0}, 0 };
+	struct mb_cmd_pack *mb_pack = NULL;
+	int ret = 0;
+
+	mb_pack = mailbox_alloc_cmd_pack();
+	if (!mb_pack)
+		return -ENOMEM;
+
+	if (cmd_id == GLOBAL_CMD_ID_REGISTER_FIXED_MEM) {
+		mb_pack->operation.paramtypes = teec_param_types(
+			TEE_PARAM_TYPE_MEMREF_PAGELIST_INOUT,
+			TEE_PARAM_TYPE_VALUE_OUTPUT, TEE_PARAM_TYPE_NONE,
+			TEE_PARAM_TYPE_NONE);
+		mb_pack->operation.params[0].memref.buffer =
+			virt_to_phys(buf->temp_buffer);
+		mb_pack->operation.buffer_h_addr[0] =
+			(uint64_t)virt_to_phys(buf->temp_buffer) >> ADDR_TRANS_NUM;
+		mb_pack->operation.params[0].memref.size = buf->size;
+	} else {
+		mb_pack->operation.paramtypes = TEE_PARAM_TYPE_VALUE_INPUT;
+		mb_pack->operation.params[0].value.a = *tee_handle;
+	}
+
+	smc_cmd.cmd_type = CMD_TYPE_GLOBAL;
+	smc_cmd.cmd_id = cmd_id;
+	smc_cmd.dev_file_id = dev_file_id;
+	smc_cmd.operation_phys = virt_to_phys(&mb_pack->operation);
+	smc_cmd.operation_h_phys =
+		(uint64_t)virt_to_phys(&mb_pack->operation) >> ADDR_TRANS_NUM;
+
+	if (tc_ns_smc(&smc_cmd)) {
+		tloge("fixed buf cmd 0x%x failed, ret 0x%x\n",
+			cmd_id, smc_cmd.ret_val);
+		ret = -EPERM;
+	} else if (cmd_id == GLOBAL_CMD_ID_REGISTER_FIXED_MEM) {
+		*tee_handle = mb_pack->operation.params[1].value.a;
+	}
+
+	mailbox_free(mb_pack);
+	return ret;
+}
+
+static void free_fixed_buf(struct tc_ns_fixed_buf *fixed_buf)
+{
+	if (send_fixed_buf_cmd(fixed_buf->dev_file_id,
+		GLOBAL_CMD_ID_UNREGISTER_FIXED_MEM, &fixed_buf->buf,
+		&fixed_buf->tee_handle))
+		tloge("unregister fixed buf from TEE failed\n");
+
+	uncharge_pinned_vm(fixed_buf->mm, fixed_buf->buf.page_num);
+	mmdrop(fixed_buf->mm);
+	tc_mem_unpin_user_buf(&fixed_buf->buf, true);
+	kfree(fixed_buf);
+}
+
+void tc_mem_fixed_buf_put(struct tc_ns_fixed_buf *fixed_buf)
+{
+	if (fixed_buf && atomic_dec_and_test(&fixed_buf->usage))
+		free_fixed_buf(fixed_buf);
+}
+
+struct tc_ns_fixed_buf *tc_mem_fixed_buf_get(struct tc_ns_dev_file *dev_file,
+	uint32_t index)
+{
+	struct tc_ns_fixed_buf *fixed_buf = NULL;
+
+	if (!dev_file || index >= MAX_FIXED_BUF_NUM)
+		return NULL;
+
+	mutex_lock(&dev_file->fixed_buf_lock);
+	fixed_buf = dev_file->fixed_bufs[index];
+	if (fixed_buf)
+		atomic_inc(&fixed_buf->usage);
+	mutex_unlock(&dev_file->fixed_buf_lock);
+
+	return fixed_buf;
+}
+
+static int pin_fixed_buf(const struct tc_ns_dev_file *dev_file,
+	const struct tc_ns_client_fixed_buf *args,
+	struct tc_ns_fixed_buf **out)
+{
+	struct tc_ns_fixed_buf *fixed_buf = NULL;
+	struct mm_struct *mm = current->mm;
+	unsigned long page_num = pagelist_page_num(
+		offset_in_page((uintptr_t)args->addr), args->size);
+	int ret;
+
+	if (!mm)
+		return -EFAULT;
+
+	fixed_buf = kzalloc(sizeof(*fixed_buf), GFP_KERNEL);
+	if (ZERO_OR_NULL_PTR((unsigned long)(uintptr_t)fixed_buf)) {
+		tloge("alloc fixed buf failed\n");
+		return -ENOMEM;
+	}
+
+	ret = charge_pinned_vm(mm, page_num);
+	if (ret)
+		goto free_buf;
+
+	ret = pin_user_buf((void __user *)(uintptr_t)args->addr,
+		args->size, true, true, &fixed_buf->buf);
+	if (ret)
+		goto uncharge;
+
+	if (send_fixed_buf_cmd(dev_file->dev_file_id,
+		GLOBAL_CMD_ID_REGISTER_FIXED_MEM, &fixed_buf->buf,
+		&fixed_buf->tee_handle)) {
+		tc_mem_unpin_user_buf(&fixed_buf->buf, false);
+		ret = -EFAULT;
+		goto uncharge;
+	}
+
+	/* TEE keeps its own mapping, page list is no longer needed */
+	mailbox_free(fixed_buf->buf.temp_buffer);
+	fixed_buf->buf.temp_buffer = NULL;
+	fixed_buf->dev_file_id = dev_file->dev_file_id;
+	/* the buf may be freed at close, after the CA mm is gone */
+	mmgrab(mm);
+	fixed_buf->mm = mm;
+	atomic_set(&fixed_buf->usage, 1);
+	*out = fixed_buf;
+	return 0;
+
+uncharge:
+	uncharge_pinned_vm(mm, page_num);
+free_buf:
+	kfree(fixed_buf);
+	return ret;
+}
+
+/*
+ * pin a CA buffer and map it to TEE once, later invokes refer to it
+ * by TEEC_MEMREF_FIXED_INOUT with the returned index and an offset
+ */
+int tc_mem_register_fixed_buf(struct tc_ns_dev_file *dev_file,
+	void __user *argp)
+{
+	struct tc_ns_client_fixed_buf args;
+	struct tc_ns_fixed_buf *fixed_buf = NULL;
+	uint32_t index;
+	int ret;
+
+	if (!dev_file || !argp)
+		return -EINVAL;
+
+	if (copy_from_user(&args, argp, sizeof(args))) {
+		tloge("copy fixed buf args failed\n");
+		return -EFAULT;
+	}
+
+	if (!args.addr || !args.size || args.size > MAX_FIXED_BUF_SIZE) {
+		tloge("invalid fixed buf size %u\n", args.size);
+		return -EINVAL;
+	}
+
+	mutex_lock(&dev_file->fixed_buf_lock);
+	for (index = 0; index < MAX_FIXED_BUF_NUM; index++) {
+		if (!dev_file->fixed_bufs[index])
+			break;
+	}
+	if (index == MAX_FIXED_BUF_NUM) {
+		mutex_unlock(&dev_file->fixed_buf_lock);
+		tloge("too many fixed bufs\n");
+		return -ENOSPC;
+	}
+
+	ret = pin_fixed_buf(dev_file, &args, &fixed_buf);
+	if (ret) {
+		mutex_unlock(&dev_file->fixed_buf_lock);
+		return ret;
+	}
+	dev_file->fixed_bufs[index] = fixed_buf;
+	mutex_unlock(&dev_file->fixed_buf_lock);
+
+	args.index = index;
+	if (copy_to_user(argp, &args, sizeof(args))) {
+		mutex_lock(&dev_file->fixed_buf_lock);
+		dev_file->fixed_bufs[index] = NULL;
+		mutex_unlock(&dev_file->fixed_buf_lock);
+		tc_mem_fixed_buf_put(fixed_buf);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+int tc_mem_unregister_fixed_buf(struct tc_ns_dev_file *dev_file,
+	const void __user *argp)
+{
+	struct tc_ns_client_fixed_buf args;
+	struct tc_ns_fixed_buf *fixed_buf = NULL;
+
+	if (!dev_file || !argp)
+		return -EINVAL;
+
+	if (copy_from_user(&args, argp, sizeof(args))) {
+		tloge("copy fixed buf args failed\n");
+		return -EFAULT;
+	}
+
+	if (args.index >= MAX_FIXED_BUF_NUM)
+		return -EINVAL;
+
+	mutex_lock(&dev_file->fixed_buf_lock);
+	fixed_buf = dev_file->fixed_bufs[args.index];
+	dev_file->fixed_bufs[args.index] = NULL;
+	mutex_unlock(&dev_file->fixed_buf_lock);
+	if (!fixed_buf)
+		return -EINVAL;
+
+	/* invokes still using it hold their own ref */
+	tc_mem_fixed_buf_put(fixed_buf);
+	return 0;
+}
+
+void tc_mem_release_fixed_bufs(struct tc_ns_dev_file *dev_file)
+{
+	uint32_t index;
+	struct tc_ns_fixed_buf *fixed_buf = NULL;
+
+	if (!dev_file)
+		return;
+
+	for (index = 0; index < MAX_FIXED_BUF_NUM; index++) {
+		mutex_lock(&dev_file->fixed_buf_lock);
+		fixed_buf = dev_file->fixed_bufs[index];
+		dev_file->fixed_bufs[index] = NULL;
+		mutex_unlock(&dev_file->fixed_buf_lock);
+		tc_mem_fixed_buf_put(fixed_buf);
+	}
+}
+#endif
+
 struct tc_ns_shared_mem *tc_mem_allocate(size_t len)
 {
 	struct tc_ns_shared_mem *shared_mem = NULL;
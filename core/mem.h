@@ -18,15 +18,65 @@
 #ifndef MEM_H
 #define MEM_H
 #include <linux/types.h>
+#include <linux/sizes.h>
 #include "teek_ns_client.h"
 
 #define PRE_ALLOCATE_SIZE (1024*1024)
 #define MEM_POOL_ELEMENT_SIZE (64*1024)
 #define MEM_POOL_ELEMENT_NR (8)
 #define MEM_POOL_ELEMENT_ORDER (4)
+#define MAX_FIXED_BUF_SIZE SZ_64M
+
+/*
+ * describe [offset, offset + size) of a registered sharemem to TEE,
+ * followed by page_num physical addresses of the pages it covers
+ */
+struct pagelist_info {
+	uint64_t page_num;
+	uint64_t page_size;
+	uint64_t sharedmem_offset; /* offset in the first page */
+	uint64_t sharedmem_size;
+	uint64_t phys_addr[0];
+};
 
 struct tc_ns_shared_mem *tc_mem_allocate(size_t len);
 void tc_mem_free(struct tc_ns_shared_mem *shared_mem);
+#ifdef CONFIG_SHARED_MEM_PAGELIST
+size_t tc_mem_pagelist_size(uint32_t offset, uint32_t size);
+int tc_mem_fill_pagelist(const struct tc_ns_shared_mem *shared_mem,
+	uint32_t offset, uint32_t size, struct pagelist_info *info,
+	size_t info_len);
+int tc_mem_pin_user_buf(const void __user *user_addr, uint32_t size,
+	bool write, struct tc_ns_temp_buf *buf);
+void tc_mem_unpin_user_buf(struct tc_ns_temp_buf *buf, bool dirty);
+int tc_mem_register_fixed_buf(struct tc_ns_dev_file *dev_file,
+	void __user *argp);
+int tc_mem_unregister_fixed_buf(struct tc_ns_dev_file *dev_file,
+	const void __user *argp);
+struct tc_ns_fixed_buf *tc_mem_fixed_buf_get(struct tc_ns_dev_file *dev_file,
+	uint32_t index);
+void tc_mem_fixed_buf_put(struct tc_ns_fixed_buf *fixed_buf);
+void tc_mem_release_fixed_bufs(struct tc_ns_dev_file *dev_file);
+#else
+/* temp bufs are never pinned without page lists */
+static inline void tc_mem_unpin_user_buf(struct tc_ns_temp_buf *buf,
+	bool dirty)
+{
+	(void)buf;
+	(void)dirty;
+}
+
+static inline void tc_mem_release_fixed_bufs(struct tc_ns_dev_file *dev_file)
+{
+	(void)dev_file;
+}
+#endif
+int tc_mem_index_add(struct tc_ns_dev_file *dev_file,
+	struct tc_ns_shared_mem *shared_mem, const void *user_addr);
+struct tc_ns_shared_mem *tc_mem_index_del(struct tc_ns_dev_file *dev_file,
+	const void *user_addr);
+struct tc_ns_shared_mem *tc_mem_find_get(struct tc_ns_dev_file *dev_file,
+	const void *user_addr);
 
 static inline void get_sharemem_struct(struct tc_ns_shared_mem *sharemem)
 {
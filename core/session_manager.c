@@ -27,8 +27,9 @@
 #include <linux/uaccess.h>
 #include <linux/sched.h>
 #include <asm/cacheflush.h>
-#include <linux/kthread.h>
 #include <linux/atomic.h>
+#include <linux/rculist.h>
+#include <linux/rwsem.h>
 #include <linux/vmalloc.h>
 #include <linux/pid.h>
 #include <linux/cred.h>
@@ -42,6 +43,8 @@
 #include <linux/sched/task.h>
 #endif
 #include <linux/completion.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
 #include "smc_smp.h"
 #include "mem.h"
 #include "gp_ops.h"
@@ -53,11 +56,33 @@
 #include "teec_daemon_auth.h"
 #include "tz_kthread_affinity.h"
 
-static DEFINE_MUTEX(g_load_app_lock);
+/*
+ * TA loads are serialized per uuid: openers of one TA wait for a single
+ * load while different TAs load in parallel
+ */
+struct ta_load_lock {
+	unsigned char uuid[UUID_LEN];
+	struct mutex lock;
+	uint32_t users;
+	struct list_head head;
+	/* dev file of a segmented load in progress, see load_stream */
+	struct tc_ns_dev_file *streamer;
+};
+
+static LIST_HEAD(g_ta_load_locks);
+static DEFINE_MUTEX(g_ta_load_locks_lock);
+/*
+ * held shared with any ta_load_lock, and exclusive by loads of images
+ * whose uuid the driver does not know, which then exclude all others
+ */
+static DECLARE_RWSEM(g_ta_load_sem);
+/* bumped when a TA dies, loaded marks of services taken before are stale */
+static atomic_t g_ta_crash_gen = ATOMIC_INIT(0);
 #define MAX_REF_COUNT (255)
 
 /* record all service node and need mutex to avoid race */
 struct list_head g_service_list;
+/* for insertion and removal of g_service_list, lookups are under rcu */
 DEFINE_MUTEX(g_service_list_lock);
 
 struct load_img_params {
@@ -68,6 +93,18 @@ struct load_img_params {
 	char *mb_load_mem;
 	struct tc_uuid *uuid_return;
 	unsigned int mb_load_size;
+	bool mb_load_reserved; /* mb_load_mem is the reserved load region */
+	/*
+	 * 2nd frame buffer, next frame is copied while tee checks this
+	 * one; only taken from the pool while no one waits on it
+	 */
+	char *mb_load_spare;
+};
+
+struct load_frame_work {
+	struct work_struct work;
+	struct tc_ns_smc_cmd *smc_cmd;
+	int smc_ret;
 };
 
 void init_srvc_list(void)
@@ -99,6 +136,7 @@ void put_session_struct(struct tc_ns_session *session)
 		session->teec_token.token_buffer = NULL;
 	}
 #endif
+	free_session_invoke_ctx(session);
 	if (memset_s(session, sizeof(*session), 0, sizeof(*session)))
 		tloge("Caution, memset failed!\n");
 	kfree(session);
@@ -119,14 +157,16 @@ void put_service_struct(struct tc_ns_service *service)
 		return;
 
 	tlogd("service->usage = %d\n", atomic_read(&service->usage));
+	if (!atomic_dec_and_test(&service->usage))
+		return;
+
+	tlogd("del service [0x%x] from service list\n",
+		*(uint32_t *)service->uuid);
 	mutex_lock(&g_service_list_lock);
-	if (atomic_dec_and_test(&service->usage)) {
-		tlogd("del service [0x%x] from service list\n",
-			*(uint32_t *)service->uuid);
-		list_del(&service->head);
-		kfree(service);
-	}
+	list_del_rcu(&service->head);
 	mutex_unlock(&g_service_list_lock);
+	/* lockless lookups may still be walking over it */
+	kfree_rcu(service, rcu);
 }
 
 static int add_service_to_dev(struct tc_ns_dev_file *dev,
@@ -263,6 +303,7 @@ struct tc_ns_session *tc_find_session_by_uuid(unsigned int dev_file_id,
 	get_service_struct(service);
 	mutex_unlock(&dev_file->service_lock);
 	if (!service) {
+		put_dev_file(dev_file);
 		tloge("can't find service!\n");
 		return NULL;
 	}
@@ -273,6 +314,7 @@ struct tc_ns_session *tc_find_session_by_uuid(unsigned int dev_file_id,
 	get_session_struct(session);
 	mutex_unlock(&service->session_lock);
 	put_service_struct(service);
+	put_dev_file(dev_file);
 	if (!session) {
 		tloge("can't find session-0x%x!\n", cmd->context_id);
 		return NULL;
@@ -334,9 +376,105 @@ clean:
 	return ret;
 }
 
+/* take the load lock again, the caller keeps its ref */
+static void relock_ta_load(struct ta_load_lock *load_lock)
+{
+	down_read(&g_ta_load_sem);
+	mutex_lock(&load_lock->lock);
+}
+
+/* drop the load lock but keep the ref */
+static void release_ta_load(struct ta_load_lock *load_lock)
+{
+	mutex_unlock(&load_lock->lock);
+	up_read(&g_ta_load_sem);
+}
+
+static void unlock_ta_load(struct ta_load_lock *load_lock)
+{
+	release_ta_load(load_lock);
+
+	mutex_lock(&g_ta_load_locks_lock);
+	if (--load_lock->users == 0) {
+		list_del(&load_lock->head);
+		mutex_destroy(&load_lock->lock);
+		kfree(load_lock);
+	}
+	mutex_unlock(&g_ta_load_locks_lock);
+}
+
+/*
+ * return the load lock of uuid held, -EBUSY if it is being loaded in
+ * segments
+ */
+static struct ta_load_lock *lock_ta_load(struct tc_ns_dev_file *dev_file,
+	const unsigned char *uuid)
+{
+	struct ta_load_lock *load_lock = NULL;
+
+	mutex_lock(&g_ta_load_locks_lock);
+	list_for_each_entry(load_lock, &g_ta_load_locks, head) {
+		if (!memcmp(load_lock->uuid, uuid, UUID_LEN)) {
+			load_lock->users++;
+			goto lock;
+		}
+	}
+
+	load_lock = kzalloc(sizeof(*load_lock), GFP_KERNEL);
+	if (ZERO_OR_NULL_PTR((unsigned long)(uintptr_t)load_lock)) {
+		tloge("alloc ta load lock failed\n");
+		mutex_unlock(&g_ta_load_locks_lock);
+		return ERR_PTR(-ENOMEM);
+	}
+	(void)memcpy_s(load_lock->uuid, sizeof(load_lock->uuid),
+		uuid, UUID_LEN);
+	mutex_init(&load_lock->lock);
+	load_lock->users = 1;
+	list_add_tail(&load_lock->head, &g_ta_load_locks);
+lock:
+	mutex_unlock(&g_ta_load_locks_lock);
+	relock_ta_load(load_lock);
+	if (load_lock->streamer) {
+		tloge("secfile is being loaded in segments\n");
+		unlock_ta_load(load_lock);
+		return ERR_PTR(-EBUSY);
+	}
+	return load_lock;
+}
+
+/*
+ * lock for loading a whole image on dev_file, which must not mix its
+ * frames with those of a segmented load the fd has in progress
+ */
+static struct ta_load_lock *lock_ta_image_load(
+	struct tc_ns_dev_file *dev_file, const unsigned char *uuid)
+{
+	struct ta_load_lock *load_lock = NULL;
+
+	mutex_lock(&dev_file->load_stream_lock);
+	if (dev_file->load_stream) {
+		mutex_unlock(&dev_file->load_stream_lock);
+		tloge("fd is loading a secfile in segments\n");
+		return ERR_PTR(-EBUSY);
+	}
+
+	load_lock = lock_ta_load(dev_file, uuid);
+	if (IS_ERR(load_lock))
+		mutex_unlock(&dev_file->load_stream_lock);
+	return load_lock;
+}
+
+static void unlock_ta_image_load(struct tc_ns_dev_file *dev_file,
+	struct ta_load_lock *load_lock)
+{
+	unlock_ta_load(load_lock);
+	mutex_unlock(&dev_file->load_stream_lock);
+}
+
 int tc_ns_load_secfile(struct tc_ns_dev_file *dev_file,
 	const void __user *argp)
 {
+	struct ta_load_lock *load_lock = NULL;
 	int ret;
 	struct load_secfile_ioctl_struct ioctl_arg = { 0, {0}, 0, {NULL} };
 
@@ -351,7 +489,9 @@ int tc_ns_load_secfile(struct tc_ns_dev_file *dev_file,
 		return ret;
 	}
 
-	mutex_lock(&g_load_app_lock);
+	load_lock = lock_ta_image_load(dev_file, ioctl_arg.uuid);
+	if (IS_ERR(load_lock))
+		return (int)PTR_ERR(load_lock);
 	if (ioctl_arg.secfile_type == LOAD_TA) {
 		ret = tc_ns_need_load_image(dev_file->dev_file_id, ioctl_arg.uuid,
 			(unsigned int)UUID_LEN);
@@ -373,7 +513,7 @@ int tc_ns_load_secfile(struct tc_ns_dev_file *dev_file,
 	if (ret)
 		tloge("load TA secfile: %d failed, ret = %x",
 			ioctl_arg.secfile_type, ret);
-	mutex_unlock(&g_load_app_lock);
+	unlock_ta_image_load(dev_file, load_lock);
 	return ret;
 }
 
@@ -507,15 +647,20 @@ static int tc_ns_service_init(const unsigned char *uuid, uint32_t uuid_len,
 
 	INIT_LIST_HEAD(&service->session_list);
 	mutex_init(&service->session_lock);
-	list_add_tail(&service->head, &g_service_list);
-	tlogd("add service: 0x%x to service list\n", *(uint32_t *)uuid);
 	atomic_set(&service->usage, 1);
 	mutex_init(&service->operation_lock);
+	/* publish after init, lookups are lockless */
+	list_add_tail_rcu(&service->head, &g_service_list);
+	tlogd("add service: 0x%x to service list\n", *(uint32_t *)uuid);
 	*new_service = service;
 
 	return ret;
 }
 
+/*
+ * lockless lookup with a ref got, a service whose last ref is being
+ * put is skipped, it's leaving the list
+ */
 static struct tc_ns_service *tc_find_service_from_all(
 	const unsigned char *uuid, uint32_t uuid_len)
 {
@@ -524,10 +669,15 @@ static struct tc_ns_service *tc_find_service_from_all(
 	if (!uuid || uuid_len != UUID_LEN)
 		return NULL;
 
-	list_for_each_entry(service, &g_service_list, head) {
-		if (!memcmp(service->uuid, uuid, sizeof(service->uuid)))
+	rcu_read_lock();
+	list_for_each_entry_rcu(service, &g_service_list, head) {
+		if (!memcmp(service->uuid, uuid, sizeof(service->uuid)) &&
+			atomic_inc_not_zero(&service->usage)) {
+			rcu_read_unlock();
 			return service;
+		}
 	}
+	rcu_read_unlock();
 
 	return NULL;
 }
@@ -554,11 +704,15 @@ static struct tc_ns_service *find_service(struct tc_ns_dev_file *dev_file,
 		mutex_unlock(&dev_file->service_lock);
 		return service;
 	}
+	/* if service has been opened in other dev */
+	service = tc_find_service_from_all(context->uuid, UUID_LEN);
+	if (service)
+		goto add_service;
+
 	mutex_lock(&g_service_list_lock);
+	/* search again, others may have added it before we got the lock */
 	service = tc_find_service_from_all(context->uuid, UUID_LEN);
-	/* if service has been opened in other dev */
 	if (service) {
-		get_service_struct(service);
 		mutex_unlock(&g_service_list_lock);
 		goto add_service;
 	}
@@ -601,10 +755,34 @@ static bool is_valid_ta_size(const char *file_buffer, unsigned int file_size)
 	return true;
 }
 
-static int alloc_for_load_image(struct load_img_params *params)
+static void free_load_image_mem(struct load_img_params *params)
 {
+	if (params->mb_load_spare)
+		mailbox_free(params->mb_load_spare);
+	params->mb_load_spare = NULL;
+	if (params->mb_load_reserved)
+		mailbox_load_mem_put(params->mb_load_mem);
+	else
+		mailbox_free(params->mb_load_mem);
+	params->mb_load_mem = NULL;
+	params->mb_load_reserved = false;
+}
+
+static int alloc_for_load_mem(struct load_img_params *params)
+{
+	unsigned int reserved_size = 0;
+
+	/* reserved region keeps full size frames without eating the pool */
+	params->mb_load_mem = mailbox_load_mem_get(&reserved_size);
+	if (params->mb_load_mem) {
+		params->mb_load_reserved = true;
+		if (params->mb_load_size > reserved_size)
+			params->mb_load_size = reserved_size;
+		return 0;
+	}
+
 	/* we will try any possible to alloc mailbox mem to load TA */
-	for (; params->mb_load_size > 0; params->mb_load_size >>= 1) {
+	for (; params->mb_load_size > SZ_4K; params->mb_load_size >>= 1) {
 		params->mb_load_mem = mailbox_alloc(params->mb_load_size, 0);
 		if (params->mb_load_mem)
 			break;
@@ -612,23 +790,35 @@ static int alloc_for_load_image(struct load_img_params *params)
 			params->mb_load_size);
 	}
 
+	/* the smallest frame, wait for others to release mailbox */
+	if (!params->mb_load_mem)
+		params->mb_load_mem = mailbox_alloc(params->mb_load_size,
+			MB_FLAG_WAIT);
+
 	if (!params->mb_load_mem) {
 		tloge("alloc TA load mem failed\n");
 		return -ENOMEM;
 	}
+	return 0;
+}
+
+static int alloc_for_load_image(struct load_img_params *params)
+{
+	int ret = alloc_for_load_mem(params);
+
+	if (ret)
+		return ret;
 
 	params->mb_pack = mailbox_alloc_cmd_pack();
 	if (!params->mb_pack) {
-		mailbox_free(params->mb_load_mem);
-		params->mb_load_mem = NULL;
+		free_load_image_mem(params);
 		tloge("alloc mb pack failed\n");
 		return -ENOMEM;
 	}
 
 	params->uuid_return = mailbox_alloc(sizeof(*(params->uuid_return)), 0);
 	if (!params->uuid_return) {
-		mailbox_free(params->mb_load_mem);
-		params->mb_load_mem = NULL;
+		free_load_image_mem(params);
 		mailbox_free(params->mb_pack);
 		params->mb_pack = NULL;
 		tloge("alloc uuid failed\n");
@@ -637,11 +827,10 @@ static int alloc_for_load_image(struct load_img_params *params)
 	return 0;
 }
 
-static void pack_load_frame_cmd(uint32_t load_size,
+static void pack_load_frame_cmd(char *mb_load_mem, uint32_t load_size,
 	const struct load_img_params *params, struct tc_ns_smc_cmd *smc_cmd)
 {
 	struct mb_cmd_pack *mb_pack = params->mb_pack;
-	char *mb_load_mem = params->mb_load_mem;
 	struct tc_uuid *uuid_return = params->uuid_return;
 
 	mb_pack->operation.params[0].memref.buffer =
@@ -665,11 +854,12 @@ static void pack_load_frame_cmd(uint32_t load_size,
 		(uint64_t)virt_to_phys(&mb_pack->operation) >> ADDR_TRANS_NUM;
 }
 
-static int32_t load_image_copy_file(struct load_img_params *params, uint32_t load_size,
-	int32_t load_flag, uint32_t loaded_size)
+static int32_t load_image_copy_file(struct load_img_params *params,
+	char *mb_load_mem, uint32_t load_size, int32_t load_flag,
+	uint32_t loaded_size)
 {
 	if (!current->mm) {
-		if (memcpy_s(params->mb_load_mem + sizeof(load_flag),
+		if (memcpy_s(mb_load_mem + sizeof(load_flag),
 			params->mb_load_size - sizeof(load_flag),
 			params->file_buffer + loaded_size, load_size) != 0) {
 			tloge("memcpy file buf get fail\n");
@@ -677,7 +867,7 @@ static int32_t load_image_copy_file(struct load_img_params *params, uint32_t loa
 		}
 		return 0;
 	}
-	if (copy_from_user(params->mb_load_mem + sizeof(load_flag),
+	if (copy_from_user(mb_load_mem + sizeof(load_flag),
 		(void __user *)params->file_buffer + loaded_size, load_size)) {
 		tloge("file buf get fail\n");
 		return  -EFAULT;
@@ -685,43 +875,93 @@ static int32_t load_image_copy_file(struct load_img_params *params, uint32_t loa
 	return 0;
 }
 
+/* copy frame index of the image into mb_load_mem */
+static int fill_load_frame(struct load_img_params *params,
+	char *mb_load_mem, unsigned int index, unsigned int load_times,
+	uint32_t *load_size)
+{
+	int load_flag = 1; /* 0:it's last block, 1:not last block */
+	uint32_t frame_size = params->mb_load_size - sizeof(load_flag);
+	uint32_t loaded_size = index * frame_size;
+	uint32_t size = frame_size;
+
+	if (index == (load_times - 1)) {
+		load_flag = 0;
+		size = params->file_size - loaded_size;
+	}
+	if (size > frame_size) {
+		tloge("invalid load size %u/%u\n", size, params->mb_load_size);
+		return -EINVAL;
+	}
+
+	*(int *)mb_load_mem = load_flag;
+	if (load_image_copy_file(params, mb_load_mem, size, load_flag,
+		loaded_size) != 0)
+		return -EFAULT;
+	*load_size = size;
+	return 0;
+}
+
+static void load_frame_work_fn(struct work_struct *work)
+{
+	struct load_frame_work *frame_work =
+		container_of(work, struct load_frame_work, work);
+
+	frame_work->smc_ret = tc_ns_smc(frame_work->smc_cmd);
+}
+
+/*
+ * with a spare buffer the smc of frame index is sent from a worker
+ * while the caller copies frame index + 1 into it, only the caller can
+ * copy from its user memory; frames still reach tee one at a time
+ */
+static int send_load_frame(struct load_img_params *params,
+	struct tc_ns_smc_cmd *smc_cmd, char *next, unsigned int index,
+	unsigned int load_times, uint32_t *next_size, int *copy_ret)
+{
+	struct load_frame_work frame_work;
+
+	if (!next || index + 1 >= load_times)
+		return tc_ns_smc(smc_cmd);
+
+	frame_work.smc_cmd = smc_cmd;
+	frame_work.smc_ret = 0;
+	INIT_WORK_ONSTACK(&frame_work.work, load_frame_work_fn);
+	queue_work(system_unbound_wq, &frame_work.work);
+	*copy_ret = fill_load_frame(params, next, index + 1, load_times,
+		next_size);
+	flush_work(&frame_work.work);
+	destroy_work_on_stack(&frame_work.work);
+	return frame_work.smc_ret;
+}
+
 static int load_image_by_frame(struct load_img_params *params,
 	unsigned int load_times, struct tc_ns_client_return *tee_ret, enum secfile_type_t type)
 {
-	char *p = params->mb_load_mem;
-	uint32_t load_size;
-	int load_flag = 1; /* 0:it's last block, 1:not last block */
-	uint32_t loaded_size = 0;
+	char *cur = params->mb_load_mem;
+	char *next = params->mb_load_spare;
+	uint32_t load_size = 0;
+	uint32_t next_size = 0;
 	unsigned int index;
 	struct tc_ns_smc_cmd smc_cmd = { {0}, 0 };
 	int smc_ret;
+	int ret;
+
+	ret = fill_load_frame(params, cur, 0, load_times, &load_size);
+	if (ret)
+		return ret;
 
 	for (index = 0; index < load_times; index++) {
 		smc_cmd.err_origin = TEEC_ORIGIN_COMMS;
-		if (index == (load_times - 1)) {
-			load_flag = 0;
-			load_size = params->file_size - loaded_size;
-		} else {
-			load_size = params->mb_load_size - sizeof(load_flag);
-		}
-		*(int *)p = load_flag;
-		if (load_size > params->mb_load_size - sizeof(load_flag)) {
-			tloge("invalid load size %u/%u\n", load_size,
-				params->mb_load_size);
-			return  -EINVAL;
-		}
-
-		if (load_image_copy_file(params, load_size, load_flag, loaded_size) != 0)
-			return -EFAULT;
-
-		pack_load_frame_cmd(load_size, params, &smc_cmd);
+		pack_load_frame_cmd(cur, load_size, params, &smc_cmd);
 		params->mb_pack->operation.params[3].value.a = index;
 		params->mb_pack->operation.params[1].value.a = (type == LOAD_DYNAMIC_DRV ? 1 : 0);
 		smc_cmd.dev_file_id = params->dev_file->dev_file_id;
-		smc_ret = tc_ns_smc(&smc_cmd);
-		tlogd("configid=%u, ret=%d, load_flag=%d, index=%u\n",
+		smc_ret = send_load_frame(params, &smc_cmd, next, index,
+			load_times, &next_size, &ret);
+		tlogd("configid=%u, ret=%d, index=%u\n",
 			params->mb_pack->operation.params[1].value.a, smc_ret,
-			load_flag, index);
+			index);
 
 		if (smc_ret) {
 			if (tee_ret != NULL) {
@@ -730,12 +970,45 @@ static int load_image_by_frame(struct load_img_params *params,
 			}
 			return -EFAULT;
 		}
+		if (ret)
+			return ret;
+		if (index + 1 >= load_times)
+			break;
 
-		loaded_size += load_size;
+		if (next) {
+			/* next frame is in place, swap buffers */
+			char *tmp = cur;
+
+			cur = next;
+			next = tmp;
+			load_size = next_size;
+			continue;
+		}
+		ret = fill_load_frame(params, cur, index + 1, load_times,
+			&load_size);
+		if (ret)
+			return ret;
 	}
 	return 0;
 }
 
+/* must be called with g_ta_load_sem held exclusive */
+static bool is_ta_load_streaming(void)
+{
+	struct ta_load_lock *load_lock = NULL;
+	bool streaming = false;
+
+	mutex_lock(&g_ta_load_locks_lock);
+	list_for_each_entry(load_lock, &g_ta_load_locks, head) {
+		if (load_lock->streamer) {
+			streaming = true;
+			break;
+		}
+	}
+	mutex_unlock(&g_ta_load_locks_lock);
+	return streaming;
+}
+
 int tc_ns_load_image_with_lock(struct tc_ns_dev_file *dev, const char *file_buffer,
 	unsigned int file_size, enum secfile_type_t type)
 {
@@ -746,9 +1019,15 @@ int tc_ns_load_image_with_lock(struct tc_ns_dev_file *dev, const char *file_buff
 		return -EINVAL;
 	}
 
-	mutex_lock(&g_load_app_lock);
-	ret = tc_ns_load_image(dev, file_buffer, file_size, NULL, type);
-	mutex_unlock(&g_load_app_lock);
+	/* uuid of the image is not known here, keep all other loads out */
+	down_write(&g_ta_load_sem);
+	if (is_ta_load_streaming()) {
+		tloge("a secfile is being loaded in segments\n");
+		ret = -EBUSY;
+	} else {
+		ret = tc_ns_load_image(dev, file_buffer, file_size, NULL, type);
+	}
+	up_write(&g_ta_load_sem);
 
 	return ret;
 }
@@ -758,8 +1037,9 @@ int tc_ns_load_image(struct tc_ns_dev_file *dev, const char *file_buffer,
 {
 	int ret;
 	unsigned int load_times;
+	ktime_t start;
 	struct load_img_params params = {
-		dev, file_buffer, file_size, NULL, NULL, NULL, 0
+		dev, file_buffer, file_size, NULL, NULL, NULL, 0, false, NULL
 	};
 
 	if (!dev || !file_buffer) {
@@ -784,28 +1064,383 @@ int tc_ns_load_image(struct tc_ns_dev_file *dev, const char *file_buffer,
 	load_times = file_size / (params.mb_load_size - sizeof(int));
 	if (file_size % (params.mb_load_size - sizeof(int)))
 		load_times += 1;
+	/*
+	 * no wait and invokes waiting go first, without a spare buffer
+	 * frames are just not pipelined
+	 */
+	if (load_times > 1 && !mailbox_has_waiters())
+		params.mb_load_spare = mailbox_alloc(params.mb_load_size, 0);
+
+	start = ktime_get();
 	ret = load_image_by_frame(&params, load_times, tee_ret, type);
+	tlogd("load image size=%u frames=%u pipelined=%d cost %lld us\n",
+		file_size, load_times, params.mb_load_spare != NULL,
+		ktime_us_delta(ktime_get(), start));
 free_mem:
-	mailbox_free(params.mb_load_mem);
+	free_load_image_mem(&params);
 	mailbox_free(params.mb_pack);
 	mailbox_free(params.uuid_return);
 	return ret;
 }
 
+void tc_ns_invalidate_loaded_ta(void)
+{
+	atomic_inc(&g_ta_crash_gen);
+}
+
+/*
+ * tee unloads a TA when its last session is closed or it dies, so the
+ * TA is known resident while the service has open sessions and no TA
+ * died since they were opened, need load smc is not needed then
+ */
+static bool is_ta_loaded(struct tc_ns_service *service)
+{
+	bool loaded;
+
+	mutex_lock(&service->session_lock);
+	loaded = !list_empty(&service->session_list) &&
+		service->loaded_gen == (uint32_t)atomic_read(&g_ta_crash_gen);
+	mutex_unlock(&service->session_lock);
+	return loaded;
+}
+
+/*
+ * a secfile of any size loaded in segments, tee gets each segment by
+ * frames as it comes; staging memory is only held during the ioctl
+ */
+#define LOAD_STREAM_FRAME_SIZE SZ_1M
+/* streams hold the load of their TA between ioctls, bound them */
+#define MAX_LOAD_STREAM_NUM 4
+#define LOAD_STREAM_IDLE_MS 5000
+
+static atomic_t g_load_stream_num = ATOMIC_INIT(0);
+
+struct tc_ns_load_stream {
+	struct tc_ns_dev_file *dev_file;
+	unsigned long deadline; /* jiffies it is aborted at if no seg came */
+	struct ta_load_lock *load_lock;
+	enum secfile_type_t type;
+	unsigned char uuid[UUID_LEN];
+	uint64_t total_size;
+	uint64_t offset; /* bytes of the image got */
+	uint32_t index; /* index of the next frame */
+	bool loaded; /* tee has the TA already, segments are dropped */
+};
+
+static void end_load_stream(struct tc_ns_dev_file *dev_file)
+{
+	struct tc_ns_load_stream *stream = dev_file->load_stream;
+
+	if (!stream)
+		return;
+
+	relock_ta_load(stream->load_lock);
+	stream->load_lock->streamer = NULL;
+	unlock_ta_load(stream->load_lock);
+	kfree(stream);
+	dev_file->load_stream = NULL;
+	atomic_dec(&g_load_stream_num);
+}
+
+/* staging frame of a segment, small segments get a small frame */
+static int alloc_seg_mem(struct tc_ns_dev_file *dev_file, uint32_t seg_size,
+	struct load_img_params *params)
+{
+	params->dev_file = dev_file;
+	params->mb_load_size =
+		(seg_size > (LOAD_STREAM_FRAME_SIZE - sizeof(int))) ?
+		LOAD_STREAM_FRAME_SIZE : ALIGN(seg_size + sizeof(int), SZ_4K);
+	return alloc_for_load_image(params);
+}
+
+static void free_seg_mem(struct load_img_params *params)
+{
+	free_load_image_mem(params);
+	mailbox_free(params->mb_pack);
+	mailbox_free(params->uuid_return);
+	params->mb_pack = NULL;
+	params->uuid_return = NULL;
+}
+
+static int start_load_stream(struct tc_ns_dev_file *dev_file,
+	const struct load_secfile_seg_ioctl_struct *seg)
+{
+	struct tc_ns_load_stream *stream = NULL;
+	struct ta_load_lock *load_lock = NULL;
+	int ret = 0;
+
+	if (atomic_inc_return(&g_load_stream_num) > MAX_LOAD_STREAM_NUM) {
+		atomic_dec(&g_load_stream_num);
+		tloge("too many secfiles are loaded in segments\n");
+		return -EBUSY;
+	}
+
+	stream = kzalloc(sizeof(*stream), GFP_KERNEL);
+	if (ZERO_OR_NULL_PTR((unsigned long)(uintptr_t)stream)) {
+		tloge("alloc load stream failed\n");
+		atomic_dec(&g_load_stream_num);
+		return -ENOMEM;
+	}
+
+	load_lock = lock_ta_load(dev_file, seg->uuid);
+	if (IS_ERR(load_lock)) {
+		kfree(stream);
+		atomic_dec(&g_load_stream_num);
+		return (int)PTR_ERR(load_lock);
+	}
+	if (seg->secfile_type == LOAD_TA)
+		ret = tc_ns_need_load_image(dev_file->dev_file_id, seg->uuid,
+			(unsigned int)UUID_LEN);
+	if (ret < 0)
+		goto unlock;
+	stream->loaded = (seg->secfile_type == LOAD_TA && ret != 1);
+
+	/* keep the ref of the load lock, others are kept out by streamer */
+	load_lock->streamer = dev_file;
+	release_ta_load(load_lock);
+	stream->dev_file = dev_file;
+	stream->load_lock = load_lock;
+	stream->type = seg->secfile_type;
+	(void)memcpy_s(stream->uuid, sizeof(stream->uuid),
+		seg->uuid, sizeof(seg->uuid));
+	stream->total_size = seg->total_size;
+	dev_file->load_stream = stream;
+	return 0;
+
+unlock:
+	unlock_ta_load(load_lock);
+	kfree(stream);
+	atomic_dec(&g_load_stream_num);
+	return ret;
+}
+
+static int send_stream_frame(struct tc_ns_load_stream *stream,
+	struct load_img_params *params, uint32_t size, int load_flag)
+{
+	struct tc_ns_smc_cmd smc_cmd = { {0}, 0 };
+	int smc_ret;
+
+	*(int *)params->mb_load_mem = load_flag;
+	smc_cmd.err_origin = TEEC_ORIGIN_COMMS;
+	pack_load_frame_cmd(params->mb_load_mem, size, params, &smc_cmd);
+	params->mb_pack->operation.params[3].value.a = stream->index;
+	params->mb_pack->operation.params[1].value.a =
+		(stream->type == LOAD_DYNAMIC_DRV ? 1 : 0);
+	smc_cmd.dev_file_id = params->dev_file->dev_file_id;
+	smc_ret = tc_ns_smc(&smc_cmd);
+	if (smc_ret) {
+		tloge("load frame %u failed, ret=0x%x, origin=%u\n",
+			stream->index, smc_ret, smc_cmd.err_origin);
+		return -EFAULT;
+	}
+
+	stream->index++;
+	return 0;
+}
+
+/*
+ * the segment goes out whole before the ioctl returns, its tail in a
+ * short frame, so no staging frame is held while the CA reads on;
+ * the frame holding the end of the image goes with the last block flag
+ */
+static int copy_stream_seg(struct tc_ns_load_stream *stream,
+	const struct load_secfile_seg_ioctl_struct *seg)
+{
+	struct load_img_params params = {0};
+	uint32_t frame_size;
+	uint32_t done = 0;
+	uint32_t size;
+	int load_flag;
+	int ret;
+
+	ret = alloc_seg_mem(stream->dev_file, seg->seg_size, &params);
+	if (ret)
+		return ret;
+
+	frame_size = params.mb_load_size - sizeof(int);
+	while (done < seg->seg_size) {
+		size = min(seg->seg_size - done, frame_size);
+		if (copy_from_user(params.mb_load_mem + sizeof(int),
+			(const void __user *)(uintptr_t)(seg->file_addr + done),
+			size)) {
+			tloge("copy load segment failed\n");
+			ret = -EFAULT;
+			break;
+		}
+		done += size;
+		/* 1 is not last block, 0 is last block */
+		load_flag = (stream->offset + done == stream->total_size) ?
+			0 : 1;
+		ret = send_stream_frame(stream, &params, size, load_flag);
+		if (ret)
+			break;
+	}
+	free_seg_mem(&params);
+	if (ret)
+		return ret;
+
+	stream->offset += seg->seg_size;
+	return 0;
+}
+
+static bool is_stream_seg(const struct tc_ns_load_stream *stream,
+	const struct load_secfile_seg_ioctl_struct *seg)
+{
+	return stream && seg->offset == stream->offset &&
+		seg->total_size == stream->total_size &&
+		seg->secfile_type == stream->type &&
+		!memcmp(seg->uuid, stream->uuid, sizeof(stream->uuid));
+}
+
+static int check_secfile_seg(const struct load_secfile_seg_ioctl_struct *seg)
+{
+	if (!seg->seg_size || seg->offset >= seg->total_size ||
+		seg->total_size - seg->offset < seg->seg_size) {
+		tloge("invalid load segment %u at %llu of %llu\n",
+			seg->seg_size, seg->offset, seg->total_size);
+		return -EINVAL;
+	}
+
+	if (seg->secfile_type == LOAD_TA || seg->secfile_type == LOAD_LIB)
+		return 0;
+	if (seg->secfile_type == LOAD_DYNAMIC_DRV)
+		return check_teecd_access();
+
+	tloge("invalid secfile type: %d!", seg->secfile_type);
+	return -EINVAL;
+}
+
+int tc_ns_load_secfile_seg(struct tc_ns_dev_file *dev_file,
+	const void __user *argp)
+{
+	struct load_secfile_seg_ioctl_struct seg;
+	struct tc_ns_load_stream *stream = NULL;
+	int ret;
+
+	if (!dev_file || !argp) {
+		tloge("Invalid params !\n");
+		return -EINVAL;
+	}
+
+	if (copy_from_user(&seg, argp, sizeof(seg))) {
+		tloge("copy from user failed\n");
+		return -EFAULT;
+	}
+
+	ret = check_secfile_seg(&seg);
+	if (ret)
+		return ret;
+
+	mutex_lock(&dev_file->load_stream_lock);
+	if (!seg.offset) {
+		/* a new load drops the one left unfinished on this fd */
+		end_load_stream(dev_file);
+		ret = start_load_stream(dev_file, &seg);
+		if (ret)
+			goto unlock;
+	}
+
+	stream = dev_file->load_stream;
+	if (!is_stream_seg(stream, &seg)) {
+		tloge("load segment at %llu is out of order\n", seg.offset);
+		ret = -EINVAL;
+		goto end;
+	}
+
+	if (stream->loaded) {
+		stream->offset += seg.seg_size;
+	} else {
+		relock_ta_load(stream->load_lock);
+		ret = copy_stream_seg(stream, &seg);
+		release_ta_load(stream->load_lock);
+	}
+	if (!ret && stream->offset != stream->total_size) {
+		/* a stream left idle is aborted to give its TA load back */
+		stream->deadline = jiffies +
+			msecs_to_jiffies(LOAD_STREAM_IDLE_MS);
+		mod_delayed_work(system_wq, &dev_file->load_stream_work,
+			msecs_to_jiffies(LOAD_STREAM_IDLE_MS));
+		goto unlock;
+	}
+end:
+	if (ret)
+		tloge("load secfile: %d in segments failed, ret = %x",
+			seg.secfile_type, ret);
+	end_load_stream(dev_file);
+unlock:
+	mutex_unlock(&dev_file->load_stream_lock);
+	return ret;
+}
+
+void tc_ns_load_stream_idle(struct work_struct *work)
+{
+	struct tc_ns_dev_file *dev_file = container_of(to_delayed_work(work),
+		struct tc_ns_dev_file, load_stream_work);
+	struct tc_ns_load_stream *stream = NULL;
+
+	mutex_lock(&dev_file->load_stream_lock);
+	stream = dev_file->load_stream;
+	/* a seg may have come while this work waited for the lock */
+	if (stream && !time_before(jiffies, stream->deadline)) {
+		tloge("no load segment for %u ms, abort it\n",
+			LOAD_STREAM_IDLE_MS);
+		end_load_stream(dev_file);
+	}
+	mutex_unlock(&dev_file->load_stream_lock);
+}
+
+void tc_ns_load_stream_release(struct tc_ns_dev_file *dev_file)
+{
+	if (!dev_file)
+		return;
+
+	mutex_lock(&dev_file->load_stream_lock);
+	end_load_stream(dev_file);
+	mutex_unlock(&dev_file->load_stream_lock);
+	/* no stream is left to rearm it */
+	cancel_delayed_work_sync(&dev_file->load_stream_work);
+}
+
+/* load a TA image in kernel memory unless tee has it already */
+int tc_ns_preload_image(struct tc_ns_dev_file *dev_file,
+	const unsigned char *uuid, const char *file_buffer,
+	unsigned int file_size)
+{
+	struct ta_load_lock *load_lock = NULL;
+	int ret;
+
+	if (!dev_file || !uuid || !file_buffer)
+		return -EINVAL;
+
+	load_lock = lock_ta_image_load(dev_file, uuid);
+	if (IS_ERR(load_lock))
+		return (int)PTR_ERR(load_lock);
+	ret = tc_ns_need_load_image(dev_file->dev_file_id, uuid,
+		(unsigned int)UUID_LEN);
+	if (ret == 1) /* 1 means we need to load image */
+		ret = tc_ns_load_image(dev_file, file_buffer, file_size,
+			NULL, LOAD_TA);
+	unlock_ta_image_load(dev_file, load_lock);
+	return ret;
+}
+
 static int load_ta_image(struct tc_ns_dev_file *dev_file,
 	struct tc_ns_client_context *context)
 {
 	int ret;
 	struct tc_ns_client_return tee_ret = {0};
+	struct ta_load_lock *load_lock = NULL;
 	tee_ret.origin = TEEC_ORIGIN_COMMS;
 
-	mutex_lock(&g_load_app_lock);
+	load_lock = lock_ta_image_load(dev_file, context->uuid);
+	if (IS_ERR(load_lock))
+		return (int)PTR_ERR(load_lock);
 	ret = tc_ns_need_load_image(dev_file->dev_file_id, context->uuid,
 		(unsigned int)UUID_LEN);
 	if (ret == 1) { /* 1 means we need to load image */
 		if (!context->file_buffer) {
 			tloge("context's file_buffer is NULL");
-			mutex_unlock(&g_load_app_lock);
+			unlock_ta_image_load(dev_file, load_lock);
 			return -1;
 		}
 		ret = tc_ns_load_image(dev_file, context->file_buffer,
@@ -817,18 +1452,18 @@ static int load_ta_image(struct tc_ns_dev_file *dev_file,
 				context->returns.origin = tee_ret.origin;
 				ret = EFAULT;
 			}
-			mutex_unlock(&g_load_app_lock);
+			unlock_ta_image_load(dev_file, load_lock);
 			return ret;
 		}
 	}
-	mutex_unlock(&g_load_app_lock);
+	unlock_ta_image_load(dev_file, load_lock);
 	return ret;
 }
 
 static void init_new_sess_node(struct tc_ns_dev_file *dev_file,
 	const struct tc_ns_client_context *context,
 	struct tc_ns_service *service,
-	struct tc_ns_session *session)
+	struct tc_ns_session *session, uint32_t gen)
 {
 	session->session_id = context->session_id;
 	atomic_set(&session->usage, 1);
@@ -839,24 +1474,25 @@ static void init_new_sess_node(struct tc_ns_dev_file *dev_file,
 
 	mutex_lock(&service->session_lock);
 	list_add_tail(&session->head, &service->session_list);
+	service->loaded_gen = gen;
 	mutex_unlock(&service->session_lock);
 }
 
-static int proc_open_session(struct tc_ns_dev_file *dev_file,
-	struct tc_ns_client_context *context, struct tc_ns_service *service,
-	struct tc_ns_session *session, uint8_t flags)
+static int open_session_smc(struct tc_ns_dev_file *dev_file,
+	struct tc_ns_client_context *context,
+	struct tc_ns_session *session, uint8_t flags, bool ta_loaded)
 {
 	int ret;
 	struct tc_call_params params = {
 		dev_file, context, session, flags
 	};
 
-	mutex_lock(&service->operation_lock);
-	ret = load_ta_image(dev_file, context);
-	if (ret) {
-		tloge("load ta image failed\n");
-		mutex_unlock(&service->operation_lock);
-		return ret;
+	if (!ta_loaded) {
+		ret = load_ta_image(dev_file, context);
+		if (ret) {
+			tloge("load ta image failed\n");
+			return ret;
+		}
 	}
 
 	ret = get_session_secure_params(dev_file, context, session);
@@ -864,7 +1500,6 @@ static int proc_open_session(struct tc_ns_dev_file *dev_file,
 		tloge("Get session secure parameters failed, ret = %d\n", ret);
 		/* Clean this session secure information */
 		clean_session_secure_information(session);
-		mutex_unlock(&service->operation_lock);
 		return ret;
 	}
 #ifdef CONFIG_AUTH_ENHANCE
@@ -876,7 +1511,6 @@ static int proc_open_session(struct tc_ns_dev_file *dev_file,
 		tloge("kzalloc %d bytes token failed\n", TOKEN_BUFFER_LEN);
 		/* Clean this session secure information */
 		clean_session_secure_information(session);
-		mutex_unlock(&service->operation_lock);
 		return -ENOMEM;
 	}
 #endif
@@ -884,16 +1518,46 @@ static int proc_open_session(struct tc_ns_dev_file *dev_file,
 	if (ret) {
 		/* Clean this session secure information */
 		clean_session_secure_information(session);
-		mutex_unlock(&service->operation_lock);
 		tloge("smc call returns error, ret=0x%x\n", ret);
-		return ret;
 	}
-	init_new_sess_node(dev_file, context, service, session);
+	return ret;
+}
+
+static int proc_open_session(struct tc_ns_dev_file *dev_file,
+	struct tc_ns_client_context *context, struct tc_ns_service *service,
+	struct tc_ns_session *session, uint8_t flags)
+{
+	int ret;
+	uint32_t gen = (uint32_t)atomic_read(&g_ta_crash_gen);
+	bool ta_loaded = is_ta_loaded(service);
+
+	/*
+	 * image load, secure params and the open smc only touch this
+	 * session, so opens to one TA run concurrently
+	 */
+	ret = open_session_smc(dev_file, context, session, flags, ta_loaded);
+	/*
+	 * the last session was being closed when we looked, tee has
+	 * unloaded the TA, so go through need load this time
+	 */
+	if (ret == EFAULT && ta_loaded &&
+		context->returns.code == TEEC_ERROR_SERVICE_NOT_EXIST) {
+		tlogd("TA unloaded under open session, retry with load\n");
+		free_session_token_buf(session);
+		ret = open_session_smc(dev_file, context, session, flags,
+			false);
+	}
+	if (ret)
+		return ret;
 	/*
 	 * session_id in tee is unique, but in concurrency scene
-	 * same session_id may appear in tzdriver, put session_list
-	 * add/del in service->operation_lock can avoid it.
+	 * same session_id may appear in tzdriver: tee may hand out the
+	 * id of a session whose close is still in flight. Close holds
+	 * service->operation_lock from lookup to list_del, so adding
+	 * under it keeps the ids in session_list unique.
 	 */
+	mutex_lock(&service->operation_lock);
+	init_new_sess_node(dev_file, context, service, session, gen);
 	mutex_unlock(&service->operation_lock);
 	return ret;
 }
@@ -1032,32 +1696,151 @@ static int close_session(struct tc_ns_dev_file *dev,
 	return ret;
 }
 
-static void close_session_in_service_list(struct tc_ns_dev_file *dev,
-	struct tc_ns_service *service)
+/* sessions taken off a service at once, bounded by kthread stack */
+#define CLOSE_BATCH_MAX 64
+
+/*
+ * the batch cmd has no per session token, so with auth enhance the
+ * sessions are always closed one by one
+ */
+#if defined(CONFIG_TEE_CLOSE_SESSION_BATCH) && !defined(CONFIG_AUTH_ENHANCE)
+#define TEE_CLOSE_SESSION_BATCH
+#endif
+
+#ifdef TEE_CLOSE_SESSION_BATCH
+struct close_batch_buf {
+	uint8_t uuid[UUID_LEN];
+	uint32_t session_id[CLOSE_BATCH_MAX];
+};
+
+/*
+ * the first batch smc probes whether tee has the batch cmd, the answer
+ * is kept; without it sessions are closed one by one
+ */
+enum close_batch_support {
+	CLOSE_BATCH_UNKNOWN,
+	CLOSE_BATCH_SUPPORTED,
+	CLOSE_BATCH_UNSUPPORTED,
+};
+
+static int g_close_batch_support = CLOSE_BATCH_UNKNOWN;
+
+static int close_session_batch(const struct tc_ns_dev_file *dev,
+	const struct tc_ns_service *service,
+	struct tc_ns_session **sessions, uint32_t num)
 {
-	int ret;
-	struct tc_ns_session *session = NULL;
+	struct tc_ns_smc_cmd smc_cmd = { {0}, 0 };
+	struct mb_cmd_pack *mb_pack = NULL;
+	struct close_batch_buf *buf = NULL;
+	uint32_t i;
+	int ret = 0;
 
-	session = tc_find_and_del_session(service, dev);
-	while (session) {
-		ret = close_session(dev, session, service->uuid,
-			(unsigned int)UUID_LEN, session->session_id);
-		if (ret)
+	mb_pack = mailbox_alloc_cmd_pack();
+	if (!mb_pack)
+		return -ENOMEM;
+	buf = mailbox_alloc(sizeof(*buf), MB_FLAG_ZERO);
+	if (!buf) {
+		mailbox_free(mb_pack);
+		return -ENOMEM;
+	}
+
+	if (memcpy_s(buf->uuid, sizeof(buf->uuid), service->uuid, UUID_LEN)) {
+		ret = -EFAULT;
+		goto free_mem;
+	}
+	for (i = 0; i < num; i++)
+		buf->session_id[i] = sessions[i]->session_id;
+
+	mb_pack->operation.paramtypes = teec_param_types(
+		TEE_PARAM_TYPE_MEMREF_INPUT, TEE_PARAM_TYPE_VALUE_INPUT,
+		TEE_PARAM_TYPE_NONE, TEE_PARAM_TYPE_NONE);
+	mb_pack->operation.params[0].memref.buffer = virt_to_phys(buf);
+	mb_pack->operation.buffer_h_addr[0] =
+		(uint64_t)virt_to_phys(buf) >> ADDR_TRANS_NUM;
+	mb_pack->operation.params[0].memref.size = sizeof(*buf);
+	mb_pack->operation.params[1].value.a = num;
+
+	smc_cmd.cmd_type = CMD_TYPE_GLOBAL;
+	smc_cmd.cmd_id = GLOBAL_CMD_ID_CLOSE_SESSION_BATCH;
+	smc_cmd.dev_file_id = dev->dev_file_id;
+	smc_cmd.operation_phys = virt_to_phys(&mb_pack->operation);
+	smc_cmd.operation_h_phys =
+		(uint64_t)virt_to_phys(&mb_pack->operation) >> ADDR_TRANS_NUM;
+
+	if (tc_ns_smc(&smc_cmd)) {
+		if (cmpxchg(&g_close_batch_support, CLOSE_BATCH_UNKNOWN,
+			CLOSE_BATCH_UNSUPPORTED) == CLOSE_BATCH_UNKNOWN)
+			tlogi("tee does not support batch close, ret 0x%x\n",
+				smc_cmd.ret_val);
+		else
+			tloge("batch close %u sessions failed, ret 0x%x\n",
+				num, smc_cmd.ret_val);
+		ret = -EPERM;
+	} else {
+		(void)cmpxchg(&g_close_batch_support, CLOSE_BATCH_UNKNOWN,
+			CLOSE_BATCH_SUPPORTED);
+	}
+
+free_mem:
+	mailbox_free(buf);
+	mailbox_free(mb_pack);
+	return ret;
+}
+#endif
+
+static void close_sessions(struct tc_ns_dev_file *dev,
+	struct tc_ns_service *service,
+	struct tc_ns_session **sessions, uint32_t num)
+{
+	uint32_t i;
+	bool closed = false;
+
+#ifdef TEE_CLOSE_SESSION_BATCH
+	if (num > 1 &&
+		READ_ONCE(g_close_batch_support) != CLOSE_BATCH_UNSUPPORTED)
+		closed = !close_session_batch(dev, service, sessions, num);
+#endif
+
+	for (i = 0; i < num; i++) {
+		/* after a failed batch tee rejects the ones it did close */
+		if (!closed && close_session(dev, sessions[i], service->uuid,
+			(unsigned int)UUID_LEN, sessions[i]->session_id))
 			tloge("close session smc failed when close fd!\n");
 #ifdef CONFIG_AUTH_ENHANCE
 		/* Clean session secure information */
-		if (memset_s(&session->secure_info,
-			sizeof(session->secure_info), 0,
-			sizeof(session->secure_info)))
+		if (memset_s(&sessions[i]->secure_info,
+			sizeof(sessions[i]->secure_info), 0,
+			sizeof(sessions[i]->secure_info)))
 			tloge("memset error\n");
 #endif
 
-		put_session_struct(session); /* pair with find session */
-		put_session_struct(session); /* pair with open session */
-		session = tc_find_and_del_session(service, dev);
+		put_session_struct(sessions[i]); /* pair with find session */
+		put_session_struct(sessions[i]); /* pair with open session */
 	}
 }
 
+static void close_session_in_service_list(struct tc_ns_dev_file *dev,
+	struct tc_ns_service *service)
+{
+	struct tc_ns_session *sessions[CLOSE_BATCH_MAX];
+	struct tc_ns_session *session = NULL;
+	uint32_t num;
+
+	do {
+		num = 0;
+		while (num < CLOSE_BATCH_MAX) {
+			session = tc_find_and_del_session(service, dev);
+			if (!session)
+				break;
+			sessions[num++] = session;
+		}
+		close_sessions(dev, service, sessions, num);
+	} while (session);
+}
+
+/* bound to the tz kthread cpumask, as the close threads used to be */
+static struct workqueue_struct *g_teardown_wq;
+
 static bool if_exist_unclosed_session(struct tc_ns_dev_file *dev)
 {
 	uint32_t index;
@@ -1070,9 +1853,10 @@ static bool if_exist_unclosed_session(struct tc_ns_dev_file *dev)
 	return false;
 }
 
-static int close_session_thread_fn(void *arg)
+static void close_dev_sessions(struct work_struct *work)
 {
-	struct tc_ns_dev_file *dev = arg;
+	struct tc_ns_dev_file *dev = container_of(work,
+		struct tc_ns_dev_file, close_work);
 	uint32_t index;
 	struct tc_ns_service *service = NULL;
 
@@ -1092,13 +1876,15 @@ static int close_session_thread_fn(void *arg)
 
 	tlogd("complete close all unclosed session\n");
 	complete(&dev->close_comp);
-	return 0;
 }
 
+/*
+ * sessions are closed from a kworker, not the closing task, which may
+ * be dying with signals pending; each fd has its own work, so a close
+ * blocked in tee does not hold up the others
+ */
 void close_unclosed_session_in_kthread(struct tc_ns_dev_file *dev)
 {
-	struct task_struct *close_thread = NULL;
-
 	if (!dev) {
 		tloge("dev is invalid\n");
 		return;
@@ -1107,19 +1893,38 @@ void close_unclosed_session_in_kthread(struct tc_ns_dev_file *dev)
 	if (!if_exist_unclosed_session(dev))
 		return;
 
-	close_thread = kthread_create(close_session_thread_fn,
-		dev, "close_fn_%6d", dev->dev_file_id);
-	if (unlikely(IS_ERR_OR_NULL(close_thread))) {
-		tloge("fail to create close session thread\n");
+	INIT_WORK(&dev->close_work, close_dev_sessions);
+	/* without the workqueue they are closed by the closing task */
+	if (!g_teardown_wq) {
+		close_dev_sessions(&dev->close_work);
 		return;
 	}
-
-	tz_kthread_bind_mask(close_thread);
-	wake_up_process(close_thread);
+	queue_work(g_teardown_wq, &dev->close_work);
 	wait_for_completion(&dev->close_comp);
 	tlogd("wait for completion success\n");
 }
 
+int tc_ns_teardown_init(void)
+{
+	g_teardown_wq = alloc_workqueue("tz_teardown_wq", WQ_UNBOUND, 0);
+	if (!g_teardown_wq) {
+		tloge("alloc teardown wq failed\n");
+		return -ENOMEM;
+	}
+	tz_workqueue_bind_mask(g_teardown_wq, 0);
+	return 0;
+}
+
+/* no fd is open any more, so no close work is queued */
+void tc_ns_teardown_exit(void)
+{
+	if (!g_teardown_wq)
+		return;
+
+	destroy_workqueue(g_teardown_wq);
+	g_teardown_wq = NULL;
+}
+
 int tc_ns_close_session(struct tc_ns_dev_file *dev_file,
 	const struct tc_ns_client_context *context)
 {
@@ -1233,8 +2038,77 @@ static int ioctl_session_send_cmd(struct tc_ns_dev_file *dev_file,
 	return ret;
 }
 
-int tc_client_session_ioctl(struct file *file, unsigned int cmd,
-	 unsigned long arg)
+/*
+ * a burst of invokes, possibly on several sessions, in one syscall;
+ * the contexts are copied in and out at once and run in order, the
+ * first failed entry stops the rest
+ */
+int tc_ns_send_cmd_vec(struct tc_ns_dev_file *dev_file, void __user *argp)
+{
+	struct tc_ns_client_cmd_vec vec;
+	struct tc_ns_client_context *contexts = NULL;
+	uint32_t index;
+	uint32_t count;
+	int ret = 0;
+
+	if (!dev_file || !argp) {
+		tloge("invalid params\n");
+		return -EINVAL;
+	}
+
+	if (copy_from_user(&vec, argp, sizeof(vec))) {
+		tloge("copy from user failed\n");
+		return -EFAULT;
+	}
+
+	if (!vec.num || vec.num > MAX_CMD_VEC_NUM) {
+		tloge("invalid cmd vec num %u\n", vec.num);
+		return -EINVAL;
+	}
+
+	contexts = kcalloc(vec.num, sizeof(*contexts), GFP_KERNEL);
+	if (ZERO_OR_NULL_PTR((unsigned long)(uintptr_t)contexts))
+		return -ENOMEM;
+
+	if (copy_from_user(contexts, (void __user *)(uintptr_t)vec.addr,
+		vec.num * sizeof(*contexts))) {
+		tloge("copy contexts from user failed\n");
+		ret = -EFAULT;
+		goto free_contexts;
+	}
+
+	freezer_do_not_count();
+	for (index = 0; index < vec.num; index++) {
+		contexts[index].returns.origin = TEEC_ORIGIN_COMMS;
+		ret = tc_ns_send_cmd(dev_file, &contexts[index]);
+		if (ret) {
+			tloge("send cmd %u of vec failed ret is %d\n",
+				index, ret);
+			break;
+		}
+	}
+	freezer_count();
+
+	/* the failed entry carries its return code too */
+	vec.done = index;
+	count = (index < vec.num) ? index + 1 : vec.num;
+	if (copy_to_user((void __user *)(uintptr_t)vec.addr, contexts,
+		count * sizeof(*contexts)) ||
+		copy_to_user(argp, &vec, sizeof(vec))) {
+		if (!ret)
+			ret = -EFAULT;
+	}
+
+	/* entries before are done, restarting the syscall repeats them */
+	if (ret == -ERESTARTSYS)
+		ret = -EINTR;
+free_contexts:
+	kfree(contexts);
+	return ret;
+}
+
+static int session_ioctl_cmd(struct file *file, unsigned int cmd,
+	unsigned long arg)
 {
 	int ret = -EINVAL;
 	void *argp = (void __user *)(uintptr_t)arg;
@@ -1274,6 +2148,14 @@ int tc_client_session_ioctl(struct file *file, unsigned int cmd,
 		return ret;
 	}
 	freezer_count();
+	return ret;
+}
+
+int tc_client_session_ioctl(struct file *file, unsigned int cmd,
+	 unsigned long arg)
+{
+	int ret = session_ioctl_cmd(file, cmd, arg);
+
 	/*
 	 * Don't leak ERESTARTSYS to user space.
 	 *
@@ -1300,3 +2182,17 @@ int tc_client_session_ioctl(struct file *file, unsigned int cmd,
 	}
 	return ret;
 }
+
+/*
+ * same as tc_client_session_ioctl, but run by an io_uring worker of
+ * the CA, which has no syscall to restart, so the result is final
+ */
+int tc_client_session_uring_cmd(struct file *file, unsigned int cmd,
+	unsigned long arg)
+{
+	int ret = session_ioctl_cmd(file, cmd, arg);
+
+	if (ret == -ERESTARTSYS)
+		ret = -EINTR;
+	return ret;
+}
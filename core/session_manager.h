@@ -24,17 +24,22 @@
 
 int tc_client_session_ioctl(struct file *file, unsigned int cmd,
 	unsigned long arg);
+int tc_client_session_uring_cmd(struct file *file, unsigned int cmd,
+	unsigned long arg);
 int tc_ns_open_session(struct tc_ns_dev_file *dev_file,
 	struct tc_ns_client_context *context);
 int tc_ns_close_session(struct tc_ns_dev_file *dev_file,
 	const struct tc_ns_client_context *context);
 int tc_ns_send_cmd(struct tc_ns_dev_file *dev_file,
 	struct tc_ns_client_context *context);
+int tc_ns_send_cmd_vec(struct tc_ns_dev_file *dev_file, void __user *argp);
 int tc_ns_load_image(struct tc_ns_dev_file *dev, const char *file_buffer,
 	unsigned int file_size, struct tc_ns_client_return *tee_ret, enum secfile_type_t type);
 int tc_ns_load_image_with_lock(struct tc_ns_dev_file *dev,
 	const char *buffer, unsigned int file_size, enum secfile_type_t type);
 void close_unclosed_session_in_kthread(struct tc_ns_dev_file *dev);
+int tc_ns_teardown_init(void);
+void tc_ns_teardown_exit(void);
 struct tc_ns_session *tc_find_session_by_uuid(unsigned int dev_file_id,
 	const struct tc_ns_smc_cmd *cmd);
 struct tc_ns_service *tc_find_service_in_dev(const struct tc_ns_dev_file *dev,
@@ -42,6 +47,13 @@ struct tc_ns_service *tc_find_service_in_dev(const struct tc_ns_dev_file *dev,
 struct tc_ns_session *tc_find_session_withowner(
 	const struct list_head *session_list, unsigned int session_id,
 	struct tc_ns_dev_file *dev_file);
+int tc_ns_load_secfile_seg(struct tc_ns_dev_file *dev_file,
+	const void __user *argp);
+void tc_ns_load_stream_release(struct tc_ns_dev_file *dev_file);
+void tc_ns_load_stream_idle(struct work_struct *work);
+int tc_ns_preload_image(struct tc_ns_dev_file *dev_file,
+	const unsigned char *uuid, const char *file_buffer,
+	unsigned int file_size);
 int tc_ns_load_secfile(struct tc_ns_dev_file *dev_file,
 	const void __user *argp);
 void get_service_struct(struct tc_ns_service *service);
@@ -50,5 +62,6 @@ void get_session_struct(struct tc_ns_session *session);
 void put_session_struct(struct tc_ns_session *session);
 void dump_services_status(const char *param);
 void init_srvc_list(void);
+void tc_ns_invalidate_loaded_ta(void);
 
 #endif
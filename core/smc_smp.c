@@ -65,6 +65,7 @@
 #include "log_cfg_api.h"
 #include "tz_kthread_affinity.h"
 #include "tee_compat_check.h"
+#include "session_manager.h"
 
 #define SECS_SUSPEND_STATUS      0xA5A5
 #define PREEMPT_COUNT            10000
@@ -132,6 +133,7 @@ struct cmd_reuse_info {
 	int cmd_index;
 	int saved_index;
 	enum cmd_reuse cmd_usage;
+	struct tc_ns_session *sess; /* session of TA cmd, NULL if unknown */
 };
 
 #if CONFIG_CPU_AFF_NR
@@ -243,7 +245,8 @@ static void occupy_clean_in_doing_entry(int32_t i)
 	release_smc_buf_lock(&g_cmd_data->smc_lock);
 }
 
-static int occupy_free_smc_in_entry(const struct tc_ns_smc_cmd *cmd)
+static int occupy_free_smc_in_entry(const struct tc_ns_smc_cmd *cmd,
+	struct tc_ns_session *sess)
 {
 	int idx = -1;
 	int i;
@@ -290,11 +293,11 @@ get_smc_retry:
 		return -1;
 	}
 
-	if (update_timestamp(&g_cmd_data->in[idx])) {
+	if (update_timestamp(&g_cmd_data->in[idx], sess)) {
 		tloge("update timestamp failed!\n");
 		goto clean;
 	}
-	if (update_chksum(&g_cmd_data->in[idx])) {
+	if (update_chksum(&g_cmd_data->in[idx], sess)) {
 		tloge("update chksum failed\n");
 		goto clean;
 	}
@@ -312,7 +315,7 @@ clean:
 	return -1;
 }
 
-static int reuse_smc_in_entry(uint32_t idx)
+static int reuse_smc_in_entry(uint32_t idx, struct tc_ns_session *sess)
 {
 	int rc = 0;
 
@@ -330,11 +333,11 @@ static int reuse_smc_in_entry(uint32_t idx)
 		goto out;
 	}
 	release_smc_buf_lock(&g_cmd_data->smc_lock);
-	if (update_timestamp(&g_cmd_data->in[idx])) {
+	if (update_timestamp(&g_cmd_data->in[idx], sess)) {
 		tloge("update timestamp failed!\n");
 		return -1;
 	}
-	if (update_chksum(&g_cmd_data->in[idx])) {
+	if (update_chksum(&g_cmd_data->in[idx], sess)) {
 		tloge("update chksum failed\n");
 		return -1;
 	}
@@ -986,9 +989,10 @@ static void upload_audit_event(unsigned int eventindex)
 }
 #endif
 
-static void cmd_result_check(struct tc_ns_smc_cmd *cmd)
+static void cmd_result_check(struct tc_ns_smc_cmd *cmd,
+	struct tc_ns_session *sess)
 {
-	if (cmd->ret_val == TEEC_SUCCESS && verify_chksum(cmd)) {
+	if (cmd->ret_val == TEEC_SUCCESS && verify_chksum(cmd, sess)) {
 		cmd->ret_val = TEEC_ERROR_GENERIC;
 		tloge("verify chksum failed\n");
 	}
@@ -1001,6 +1005,7 @@ static void cmd_result_check(struct tc_ns_smc_cmd *cmd)
 			cmd->ret_val, cmd->err_origin);
 		cmd_monitor_ta_crash(TYPE_CRASH_TA);
 		ta_crash_report_log();
+		tc_ns_invalidate_loaded_ta();
 	} else if (cmd->ret_val == TEE_ERROR_AUDIT_FAIL) {
 		tloge("error smc call: ret = %x and err-origin=%x\n",
 			cmd->ret_val, cmd->err_origin);
@@ -1399,13 +1404,13 @@ static int smc_ops_normal(struct cmd_reuse_info *info,
 		return 0;
 
 	if (info->cmd_usage == RESEND) {
-		if (reuse_smc_in_entry(info->cmd_index)) {
+		if (reuse_smc_in_entry(info->cmd_index, info->sess)) {
 			tloge("reuse smc entry failed\n");
 			release_smc_entry(info->cmd_index);
 			return -ENOMEM;
 		}
 	} else {
-		info->cmd_index = occupy_free_smc_in_entry(cmd);
+		info->cmd_index = occupy_free_smc_in_entry(cmd, info->sess);
 		if (info->cmd_index == -1) {
 			tloge("there's no more smc entry\n");
 			return -ENOMEM;
@@ -1428,9 +1433,9 @@ static int smc_ops_normal(struct cmd_reuse_info *info,
 }
 
 static int smp_smc_send_cmd_done(int cmd_index, struct tc_ns_smc_cmd *cmd,
-	struct tc_ns_smc_cmd *in)
+	struct tc_ns_smc_cmd *in, struct tc_ns_session *sess)
 {
-	cmd_result_check(cmd);
+	cmd_result_check(cmd, sess);
 	switch (cmd->ret_val) {
 	case TEEC_PENDING2: {
 		unsigned int agent_id = cmd->agent_id;
@@ -1805,7 +1810,7 @@ static enum smc_status_t handle_cmd_working_done(
 		return ST_DONE;
 	}
 
-	if (smp_smc_send_cmd_done(info->cmd_index, cmd, in)) {
+	if (smp_smc_send_cmd_done(info->cmd_index, cmd, in, info->sess)) {
 		*ops = SMC_OPS_NORMAL; /* cmd will be reused */
 		return ST_RETRY;
 	}
@@ -1813,9 +1818,10 @@ static enum smc_status_t handle_cmd_working_done(
 	return ST_DONE;
 }
 
-static int smp_smc_send_func(struct tc_ns_smc_cmd *in, bool reuse)
+static int smp_smc_send_func(struct tc_ns_smc_cmd *in,
+	struct tc_ns_session *sess, bool reuse)
 {
-	struct cmd_reuse_info info = { 0, 0, CLEAR };
+	struct cmd_reuse_info info = { 0, 0, CLEAR, sess };
 	struct smc_cmd_ret cmd_ret = {0};
 	struct tc_ns_smc_cmd cmd = { {0}, 0 };
 	struct pending_entry *pe = NULL;
@@ -1874,7 +1880,7 @@ static int smc_svc_thread_fn(void *arg)
 
 		smc_cmd.cmd_type = CMD_TYPE_GLOBAL;
 		smc_cmd.cmd_id = GLOBAL_CMD_ID_SET_SERVE_CMD;
-		ret = smp_smc_send_func(&smc_cmd, false);
+		ret = smp_smc_send_func(&smc_cmd, NULL, false);
 		tlogd("smc svc return 0x%x\n", ret);
 	}
 	tloge("smc svc thread stop\n");
@@ -1910,7 +1916,8 @@ void wakeup_tc_siq(void)
  * This function first power on crypto cell, then send smc cmd to trustedcore.
  * After finished, power off crypto cell.
  */
-static int proc_tc_ns_smc(struct tc_ns_smc_cmd *cmd, bool reuse)
+static int proc_tc_ns_smc(struct tc_ns_smc_cmd *cmd,
+	struct tc_ns_session *sess, bool reuse)
 {
 	int ret;
 	struct cmd_monitor *item = NULL;
@@ -1927,7 +1934,7 @@ static int proc_tc_ns_smc(struct tc_ns_smc_cmd *cmd, bool reuse)
 		raw_smp_processor_id());
 
 	item = cmd_monitor_log(cmd);
-	ret = smp_smc_send_func(cmd, reuse);
+	ret = smp_smc_send_func(cmd, sess, reuse);
 	cmd_monitor_logend(item);
 
 	return ret;
@@ -1935,12 +1942,19 @@ static int proc_tc_ns_smc(struct tc_ns_smc_cmd *cmd, bool reuse)
 
 int tc_ns_smc(struct tc_ns_smc_cmd *cmd)
 {
-	return proc_tc_ns_smc(cmd, false);
+	return proc_tc_ns_smc(cmd, NULL, false);
 }
 
 int tc_ns_smc_with_no_nr(struct tc_ns_smc_cmd *cmd)
 {
-	return proc_tc_ns_smc(cmd, true);
+	return proc_tc_ns_smc(cmd, NULL, true);
+}
+
+/* sess is the session of a TA cmd, held by the caller during the call */
+int tc_ns_session_smc(struct tc_ns_smc_cmd *cmd,
+	struct tc_ns_session *sess, bool reuse)
+{
+	return proc_tc_ns_smc(cmd, sess, reuse);
 }
 
 static void smc_work_no_wait(uint32_t type)
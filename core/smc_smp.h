@@ -110,6 +110,8 @@ int smc_context_init(const struct device *class_dev);
 void smc_free_data(void);
 int tc_ns_smc(struct tc_ns_smc_cmd *cmd);
 int tc_ns_smc_with_no_nr(struct tc_ns_smc_cmd *cmd);
+int tc_ns_session_smc(struct tc_ns_smc_cmd *cmd,
+	struct tc_ns_session *sess, bool reuse);
 int teeos_log_exception_archive(unsigned int eventid, const char *exceptioninfo);
 void set_cmd_send_state(void);
 int init_smc_svc_thread(void);
@@ -0,0 +1,393 @@
+/*
+ * ta_preload.c
+ *
+ * TA images registered by teecd are loaded in background after late
+ * init, so the first CA opening them does not pay the image load.
+ * A pinned TA keeps a kernel session open, tee does not unload a TA
+ * while it has sessions.
+ *
+ * Copyright (c) 2012-2021 Huawei Technologies Co., Ltd.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include "ta_preload.h"
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/workqueue.h>
+#include <securec.h>
+#include "tc_ns_log.h"
+#include "tc_ns_client.h"
+#include "teek_ns_client.h"
+#include "teek_client_constants.h"
+#include "teek_app_load.h"
+#include "session_manager.h"
+#include "tc_client_driver.h"
+#include "teec_daemon_auth.h"
+
+#ifdef CONFIG_TA_PRELOAD
+
+#define TA_PRELOAD_MAX_NUM 32
+/* after late init, let the CAs started at boot go first */
+#define TA_PRELOAD_DELAY_MS 1000
+/* failed loads are retried, the delay doubles up to this */
+#define TA_PRELOAD_RETRY_MAX_MS 60000
+
+struct ta_preload {
+	struct list_head head;
+	unsigned char uuid[UUID_LEN];
+	uint32_t flags;
+	char path[TA_PRELOAD_PATH_LEN];
+	char pkg_name[TA_PRELOAD_NAME_LEN];
+	/* kernel dev file the TA is loaded and pinned by */
+	struct tc_ns_dev_file *dev;
+	bool loaded;
+	bool pinned;
+	bool removed; /* removed while busy, freed by the work */
+#ifdef CONFIG_AUTH_ENHANCE
+	uint8_t token[TOKEN_SAVE_LEN]; /* of the pin session */
+#endif
+};
+
+static LIST_HEAD(g_preload_list);
+/* taken off g_preload_list by the work, loaded without g_preload_lock */
+static LIST_HEAD(g_preload_busy);
+/* for the lists, g_preload_num, g_preload_ready and preload->removed */
+static DEFINE_MUTEX(g_preload_lock);
+static uint32_t g_preload_num;
+static bool g_preload_ready; /* late init is done, TAs can be loaded */
+static unsigned int g_preload_retry_ms; /* only used by the work */
+
+static void preload_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(g_preload_work, preload_work_fn);
+
+static int open_preload_dev(struct ta_preload *preload)
+{
+	uint32_t name_len = (uint32_t)strnlen(preload->pkg_name,
+		sizeof(preload->pkg_name));
+	int ret;
+
+	ret = tc_ns_client_open(&preload->dev, TEE_REQ_FROM_KERNEL_MODE);
+	if (ret) {
+		tloge("open preload dev failed, ret=%d\n", ret);
+		preload->dev = NULL;
+		return ret;
+	}
+
+	/* login of the pin session, teecd vouches for it as for CAs */
+	if (name_len && memcpy_s(preload->dev->pkg_name,
+		sizeof(preload->dev->pkg_name), preload->pkg_name, name_len)) {
+		tc_ns_client_close(preload->dev);
+		preload->dev = NULL;
+		return -EFAULT;
+	}
+	preload->dev->pkg_name_len = name_len;
+	preload->dev->login_setup = true;
+	return 0;
+}
+
+static void load_preload_ta(struct ta_preload *preload)
+{
+	char *file_buf = NULL;
+	uint32_t file_len = 0;
+	int ret;
+
+	/* runs in a kworker, so the image is read in kernel */
+	if (teek_get_app(preload->path, &file_buf, &file_len) !=
+		TEEC_SUCCESS || !file_buf) {
+		tloge("read preload TA %s failed\n", preload->path);
+		return;
+	}
+
+	ret = tc_ns_preload_image(preload->dev, preload->uuid, file_buf,
+		file_len);
+	if (ret)
+		tloge("preload TA %s failed, ret=%d\n", preload->path, ret);
+	else
+		preload->loaded = true;
+	teek_free_app(true, &file_buf);
+}
+
+static void pin_preload_ta(struct ta_preload *preload)
+{
+	struct tc_ns_client_context context;
+	int ret;
+
+	if (memset_s(&context, sizeof(context), 0, sizeof(context)) ||
+		memcpy_s(context.uuid, sizeof(context.uuid),
+		preload->uuid, sizeof(preload->uuid)))
+		return;
+
+	context.returns.origin = TEEC_ORIGIN_COMMS;
+	context.login.method = TEEC_LOGIN_IDENTIFY;
+#ifdef CONFIG_AUTH_ENHANCE
+	context.token.teec_token = preload->token;
+	context.token_len = sizeof(preload->token);
+#endif
+	ret = tc_ns_open_session(preload->dev, &context);
+	if (ret) {
+		tloge("pin TA %s failed, ret=%d code=0x%x\n", preload->path,
+			ret, context.returns.code);
+		return;
+	}
+	/* closed with the dev file */
+	preload->pinned = true;
+}
+
+static bool is_preload_pending(const struct ta_preload *preload)
+{
+	return !preload->loaded || ((preload->flags & TA_PRELOAD_PIN) &&
+		!preload->pinned);
+}
+
+static void unlink_preload(struct ta_preload *preload,
+	struct list_head *dead)
+{
+	list_move_tail(&preload->head, dead);
+	g_preload_num--;
+}
+
+/* closing the dev file closes the pin session, it is an smc too */
+static void free_preloads(struct list_head *dead)
+{
+	struct ta_preload *preload = NULL;
+	struct ta_preload *tmp = NULL;
+
+	list_for_each_entry_safe(preload, tmp, dead, head) {
+		list_del(&preload->head);
+		if (preload->dev)
+			tc_ns_client_close(preload->dev);
+		kfree(preload);
+	}
+}
+
+/* called with g_preload_lock, back off while some TA keeps failing */
+static void retry_preload_locked(void)
+{
+	const struct ta_preload *preload = NULL;
+	bool pending = false;
+
+	list_for_each_entry(preload, &g_preload_list, head) {
+		if (is_preload_pending(preload)) {
+			pending = true;
+			break;
+		}
+	}
+	if (!pending || !g_preload_ready) {
+		g_preload_retry_ms = 0;
+		return;
+	}
+
+	g_preload_retry_ms = g_preload_retry_ms ? min_t(unsigned int,
+		g_preload_retry_ms * 2, TA_PRELOAD_RETRY_MAX_MS) :
+		TA_PRELOAD_DELAY_MS;
+	schedule_delayed_work(&g_preload_work,
+		msecs_to_jiffies(g_preload_retry_ms));
+}
+
+/*
+ * image reads, loads and pin opens are slow, they run on g_preload_busy
+ * without g_preload_lock, so the ioctl of teecd is not held up by them;
+ * only this work moves entries in and out of g_preload_busy
+ */
+static void preload_work_fn(struct work_struct *work)
+{
+	struct ta_preload *preload = NULL;
+	struct ta_preload *tmp = NULL;
+	LIST_HEAD(dead);
+
+	(void)work;
+	mutex_lock(&g_preload_lock);
+	list_for_each_entry_safe(preload, tmp, &g_preload_list, head) {
+		if (is_preload_pending(preload))
+			list_move_tail(&preload->head, &g_preload_busy);
+	}
+	mutex_unlock(&g_preload_lock);
+
+	list_for_each_entry(preload, &g_preload_busy, head) {
+		if (!preload->dev && open_preload_dev(preload))
+			continue;
+		if (!preload->loaded)
+			load_preload_ta(preload);
+		if (preload->loaded && !preload->pinned &&
+			(preload->flags & TA_PRELOAD_PIN))
+			pin_preload_ta(preload);
+	}
+
+	mutex_lock(&g_preload_lock);
+	list_for_each_entry_safe(preload, tmp, &g_preload_busy, head) {
+		if (preload->removed)
+			unlink_preload(preload, &dead);
+		else
+			list_move_tail(&preload->head, &g_preload_list);
+	}
+	retry_preload_locked();
+	mutex_unlock(&g_preload_lock);
+	free_preloads(&dead);
+}
+
+static struct ta_preload *find_in_list(const struct list_head *list,
+	const unsigned char *uuid)
+{
+	struct ta_preload *preload = NULL;
+
+	list_for_each_entry(preload, list, head) {
+		if (!preload->removed &&
+			!memcmp(preload->uuid, uuid, sizeof(preload->uuid)))
+			return preload;
+	}
+	return NULL;
+}
+
+static struct ta_preload *find_preload(const unsigned char *uuid)
+{
+	struct ta_preload *preload = find_in_list(&g_preload_list, uuid);
+
+	if (!preload)
+		preload = find_in_list(&g_preload_busy, uuid);
+	return preload;
+}
+
+static bool is_preload_busy(const struct ta_preload *preload)
+{
+	const struct ta_preload *pos = NULL;
+
+	list_for_each_entry(pos, &g_preload_busy, head) {
+		if (pos == preload)
+			return true;
+	}
+	return false;
+}
+
+static int check_preload_req(struct tc_ns_client_preload *req)
+{
+	if (req->flags & ~(TA_PRELOAD_PIN | TA_PRELOAD_REMOVE))
+		return -EINVAL;
+	if (req->flags & TA_PRELOAD_REMOVE)
+		return 0;
+
+	req->path[TA_PRELOAD_PATH_LEN - 1] = '\0';
+	req->pkg_name[TA_PRELOAD_NAME_LEN - 1] = '\0';
+	if (!strlen(req->path)) {
+		tloge("preload TA path is empty\n");
+		return -EINVAL;
+	}
+	if (strlen(req->pkg_name) >= MAX_PACKAGE_NAME_LEN ||
+		((req->flags & TA_PRELOAD_PIN) && !strlen(req->pkg_name))) {
+		tloge("invalid login name of pin session\n");
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static int add_preload(const struct tc_ns_client_preload *req)
+{
+	struct ta_preload *preload = NULL;
+
+	if (find_preload(req->uuid))
+		return -EEXIST;
+	if (g_preload_num >= TA_PRELOAD_MAX_NUM) {
+		tloge("too many preload TAs\n");
+		return -ENOSPC;
+	}
+
+	preload = kzalloc(sizeof(*preload), GFP_KERNEL);
+	if (ZERO_OR_NULL_PTR((unsigned long)(uintptr_t)preload)) {
+		tloge("alloc preload failed\n");
+		return -ENOMEM;
+	}
+	if (memcpy_s(preload->uuid, sizeof(preload->uuid),
+		req->uuid, sizeof(req->uuid)) ||
+		strcpy_s(preload->path, sizeof(preload->path), req->path) ||
+		strcpy_s(preload->pkg_name, sizeof(preload->pkg_name),
+		req->pkg_name)) {
+		kfree(preload);
+		return -EFAULT;
+	}
+	preload->flags = req->flags;
+	list_add_tail(&preload->head, &g_preload_list);
+	g_preload_num++;
+
+	/* a new TA does not wait out the backoff of failing ones */
+	if (g_preload_ready)
+		mod_delayed_work(system_wq, &g_preload_work, 0);
+	return 0;
+}
+
+int tc_ns_preload_ta(const void __user *argp)
+{
+	struct tc_ns_client_preload req;
+	struct ta_preload *preload = NULL;
+	LIST_HEAD(dead);
+	int ret;
+
+	if (!argp)
+		return -EINVAL;
+
+	if (check_teecd_access() != EOK) {
+		tloge("preload TA is only allowed for teecd\n");
+		return -EACCES;
+	}
+
+	if (copy_from_user(&req, argp, sizeof(req))) {
+		tloge("copy from user failed\n");
+		return -EFAULT;
+	}
+
+	ret = check_preload_req(&req);
+	if (ret)
+		return ret;
+
+	mutex_lock(&g_preload_lock);
+	if (req.flags & TA_PRELOAD_REMOVE) {
+		preload = find_preload(req.uuid);
+		if (!preload)
+			ret = -ENOENT;
+		else if (is_preload_busy(preload))
+			preload->removed = true; /* the work frees it */
+		else
+			unlink_preload(preload, &dead);
+	} else {
+		ret = add_preload(&req);
+	}
+	mutex_unlock(&g_preload_lock);
+	free_preloads(&dead);
+	return ret;
+}
+
+void ta_preload_late_init(void)
+{
+	mutex_lock(&g_preload_lock);
+	g_preload_ready = true;
+	mutex_unlock(&g_preload_lock);
+	schedule_delayed_work(&g_preload_work,
+		msecs_to_jiffies(TA_PRELOAD_DELAY_MS));
+}
+
+void ta_preload_exit(void)
+{
+	LIST_HEAD(dead);
+
+	/* keeps teecd and the work itself from queuing it again */
+	mutex_lock(&g_preload_lock);
+	g_preload_ready = false;
+	mutex_unlock(&g_preload_lock);
+	cancel_delayed_work_sync(&g_preload_work);
+
+	mutex_lock(&g_preload_lock);
+	list_splice_init(&g_preload_list, &dead);
+	g_preload_num = 0;
+	mutex_unlock(&g_preload_lock);
+	free_preloads(&dead);
+}
+#endif
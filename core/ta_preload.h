@@ -0,0 +1,37 @@
+/*
+ * ta_preload.h
+ *
+ * TA images loaded in background after late init.
+ *
+ * Copyright (c) 2012-2021 Huawei Technologies Co., Ltd.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef TA_PRELOAD_H
+#define TA_PRELOAD_H
+
+#include <linux/types.h>
+
+#ifdef CONFIG_TA_PRELOAD
+int tc_ns_preload_ta(const void __user *argp);
+void ta_preload_late_init(void);
+void ta_preload_exit(void);
+#else
+static inline void ta_preload_late_init(void)
+{
+}
+
+static inline void ta_preload_exit(void)
+{
+}
+#endif
+
+#endif
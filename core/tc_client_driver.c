@@ -59,6 +59,12 @@
 #endif
 #include <linux/acpi.h>
 #include <linux/completion.h>
+#include <linux/compat.h>
+#if (KERNEL_VERSION(6, 7, 0) <= LINUX_VERSION_CODE)
+#include <linux/io_uring/cmd.h>
+#elif (KERNEL_VERSION(5, 19, 0) <= LINUX_VERSION_CODE)
+#include <linux/io_uring.h>
+#endif
 #include "smc_smp.h"
 #include "teek_client_constants.h"
 #include "agent.h"
@@ -75,6 +81,8 @@
 #include "session_manager.h"
 #include "ko_adapt.h"
 #include "tz_pm.h"
+#include "dmabuf_mem.h"
+#include "ta_preload.h"
 #include "tz_kthread_affinity.h"
 
 static dev_t g_tc_ns_client_devt;
@@ -346,21 +354,36 @@ int tc_ns_client_open(struct tc_ns_dev_file **dev_file, uint8_t kernel_api)
 		return -ENOMEM;
 	}
 
-	mutex_lock(&g_tc_ns_dev_list.dev_lock);
-	list_add_tail(&dev->head, &g_tc_ns_dev_list.dev_file_list);
-	mutex_unlock(&g_tc_ns_dev_list.dev_lock);
 	mutex_lock(&g_device_file_cnt_lock);
 	dev->dev_file_id = g_device_file_cnt;
 	g_device_file_cnt++;
 	mutex_unlock(&g_device_file_cnt_lock);
 	INIT_LIST_HEAD(&dev->shared_mem_list);
+	INIT_RADIX_TREE(&dev->shm_addr_tree, GFP_KERNEL);
+	INIT_RADIX_TREE(&dev->shm_offset_tree, GFP_KERNEL);
 	dev->login_setup = 0;
 	dev->kernel_api = kernel_api;
 	dev->load_app_flag = 0;
 	mutex_init(&dev->service_lock);
 	mutex_init(&dev->shared_mem_lock);
 	mutex_init(&dev->login_setup_lock);
+	mutex_init(&dev->fixed_buf_lock);
+	mutex_init(&dev->load_stream_lock);
+	INIT_DELAYED_WORK(&dev->load_stream_work, tc_ns_load_stream_idle);
 	init_completion(&dev->close_comp);
+	atomic_set(&dev->mb_usage, 0);
+	atomic_set(&dev->usage, 1); /* put in free_dev */
+
+	mutex_lock(&g_tc_ns_dev_list.dev_lock);
+	if (radix_tree_insert(&g_tc_ns_dev_list.dev_file_tree,
+		dev->dev_file_id, dev)) {
+		mutex_unlock(&g_tc_ns_dev_list.dev_lock);
+		tloge("index dev file %u failed\n", dev->dev_file_id);
+		kfree(dev);
+		return -ENOMEM;
+	}
+	list_add_tail(&dev->head, &g_tc_ns_dev_list.dev_file_list);
+	mutex_unlock(&g_tc_ns_dev_list.dev_lock);
 	*dev_file = dev;
 
 	return 0;
@@ -373,16 +396,29 @@ static void del_dev_node(struct tc_ns_dev_file *dev)
 
 	mutex_lock(&g_tc_ns_dev_list.dev_lock);
 	list_del(&dev->head);
+	(void)radix_tree_delete(&g_tc_ns_dev_list.dev_file_tree,
+		dev->dev_file_id);
 	mutex_unlock(&g_tc_ns_dev_list.dev_lock);
 }
 
+void put_dev_file(struct tc_ns_dev_file *dev)
+{
+	if (!dev || !atomic_dec_and_test(&dev->usage))
+		return;
+
+	if (memset_s(dev, sizeof(*dev), 0, sizeof(*dev)))
+		tloge("Caution, memset dev fail!\n");
+	/* tc_find_dev_file may still be looking at it under rcu */
+	kfree_rcu(dev, rcu);
+}
+
 void free_dev(struct tc_ns_dev_file *dev)
 {
 	del_dev_node(dev);
+	tc_mem_release_fixed_bufs(dev);
+	tc_ns_load_stream_release(dev);
 	tee_agent_clear_dev_owner(dev);
-	if (memset_s(dev, sizeof(*dev), 0, sizeof(*dev)))
-		tloge("Caution, memset dev fail!\n");
-	kfree(dev);
+	put_dev_file(dev);
 }
 
 int tc_ns_client_close(struct tc_ns_dev_file *dev)
@@ -410,34 +446,29 @@ static void release_vma_shared_mem(struct tc_ns_dev_file *dev_file,
 	const struct vm_area_struct *vma)
 {
 	struct tc_ns_shared_mem *shared_mem = NULL;
-	struct tc_ns_shared_mem *shared_mem_temp = NULL;
-	bool find = false;
+	void *user_addr = (void *)(uintptr_t)vma->vm_start;
 
 	mutex_lock(&dev_file->shared_mem_lock);
-	list_for_each_entry_safe(shared_mem, shared_mem_temp,
-			&dev_file->shared_mem_list, head) {
-		if (shared_mem) {
-			if (shared_mem->user_addr ==
-				(void *)(uintptr_t)vma->vm_start) {
-				shared_mem->user_addr = INVALID_MAP_ADDR;
-				find = true;
-			} else if (shared_mem->user_addr_ca ==
-				(void *)(uintptr_t)vma->vm_start) {
-				shared_mem->user_addr_ca = INVALID_MAP_ADDR;
-				find = true;
-			}
+	shared_mem = tc_mem_index_del(dev_file, user_addr);
+	if (!shared_mem) {
+		mutex_unlock(&dev_file->shared_mem_lock);
+		return;
+	}
 
-			if ((shared_mem->user_addr == INVALID_MAP_ADDR) &&
-				(shared_mem->user_addr_ca == INVALID_MAP_ADDR))
-				list_del(&shared_mem->head);
+	if (shared_mem->user_addr == user_addr)
+		WRITE_ONCE(shared_mem->user_addr, INVALID_MAP_ADDR);
+	else if (shared_mem->user_addr_ca == user_addr)
+		shared_mem->user_addr_ca = INVALID_MAP_ADDR;
 
-			/* pair with tc client mmap */
-			if (find) {
-				put_sharemem_struct(shared_mem);
-				break;
-			}
-		}
+	if ((shared_mem->user_addr == INVALID_MAP_ADDR) &&
+		(shared_mem->user_addr_ca == INVALID_MAP_ADDR)) {
+		list_del(&shared_mem->head);
+		(void)radix_tree_delete(&dev_file->shm_offset_tree,
+			(unsigned long)atomic_read(&shared_mem->offset));
 	}
+
+	/* pair with tc client mmap */
+	put_sharemem_struct(shared_mem);
 	mutex_unlock(&dev_file->shared_mem_lock);
 }
 
@@ -481,25 +512,24 @@ static struct tc_ns_shared_mem *find_sharedmem(
 	 * using vma->vm_pgoff as share_mem index
 	 * check if aready allocated
 	 */
-	list_for_each_entry(shm_tmp, &dev_file->shared_mem_list, head) {
-		if (atomic_read(&shm_tmp->offset) == vma->vm_pgoff) {
-			tlogd("sharemem already alloc, shm tmp->offset=%d\n",
-				atomic_read(&shm_tmp->offset));
-			/*
-			 * args check:
-			 * 1. this shared mem is already mapped
-			 * 2. remap a different size shared_mem
-			 */
-			if ((shm_tmp->user_addr_ca != INVALID_MAP_ADDR) ||
-				(vma->vm_end - vma->vm_start != shm_tmp->len)) {
-				tloge("already remap once!\n");
-				return NULL;
-			}
-			/* return the same sharedmem specified by vm_pgoff */
-			*only_remap = true;
-			get_sharemem_struct(shm_tmp);
-			return shm_tmp;
+	shm_tmp = radix_tree_lookup(&dev_file->shm_offset_tree, vma->vm_pgoff);
+	if (shm_tmp) {
+		tlogd("sharemem already alloc, shm tmp->offset=%d\n",
+			atomic_read(&shm_tmp->offset));
+		/*
+		 * args check:
+		 * 1. this shared mem is already mapped
+		 * 2. remap a different size shared_mem
+		 */
+		if ((shm_tmp->user_addr_ca != INVALID_MAP_ADDR) ||
+			(vma->vm_end - vma->vm_start != shm_tmp->len)) {
+			tloge("already remap once!\n");
+			return NULL;
 		}
+		/* return the same sharedmem specified by vm_pgoff */
+		*only_remap = true;
+		get_sharemem_struct(shm_tmp);
+		return shm_tmp;
 	}
 
 	/* if not find, alloc a new sharemem */
@@ -519,6 +549,29 @@ static int remap_shared_mem(struct vm_area_struct *vma,
 	return ret;
 }
 
+/* publish a new sharemem to the list and both of its indexes */
+static int add_shared_mem(struct tc_ns_dev_file *dev_file,
+	struct tc_ns_shared_mem *shared_mem, unsigned long pgoff)
+{
+	int ret;
+
+	ret = radix_tree_insert(&dev_file->shm_offset_tree, pgoff, shared_mem);
+	if (ret) {
+		tloge("index sharemem offset failed, ret=%d\n", ret);
+		return ret;
+	}
+
+	/* lookup by addr is lockless, must be the last one */
+	ret = tc_mem_index_add(dev_file, shared_mem, shared_mem->user_addr);
+	if (ret) {
+		(void)radix_tree_delete(&dev_file->shm_offset_tree, pgoff);
+		return ret;
+	}
+
+	list_add_tail(&shared_mem->head, &dev_file->shared_mem_list);
+	return 0;
+}
+
 /*
  * in this func, we need to deal with follow cases:
  * vendor CA alloc sharedmem (alloc and remap);
@@ -562,14 +615,21 @@ static int tc_client_mmap(struct file *filp, struct vm_area_struct *vma)
 	vma->vm_private_data = (void *)dev_file;
 
 	if (only_remap) {
-		shared_mem->user_addr_ca = (void *)(uintptr_t)vma->vm_start;
+		ret = tc_mem_index_add(dev_file, shared_mem,
+			(void *)(uintptr_t)vma->vm_start);
+		if (ret)
+			put_sharemem_struct(shared_mem);
+		else
+			shared_mem->user_addr_ca = (void *)(uintptr_t)vma->vm_start;
 		mutex_unlock(&dev_file->shared_mem_lock);
 		return ret;
 	}
 	shared_mem->user_addr = (void *)(uintptr_t)vma->vm_start;
 	atomic_set(&shared_mem->offset, vma->vm_pgoff);
 	get_sharemem_struct(shared_mem);
-	list_add_tail(&shared_mem->head, &dev_file->shared_mem_list);
+	ret = add_shared_mem(dev_file, shared_mem, vma->vm_pgoff);
+	if (ret)
+		put_sharemem_struct(shared_mem);
 	mutex_unlock(&dev_file->shared_mem_lock);
 
 	return ret;
@@ -657,6 +717,9 @@ static long tc_agent_ioctl(struct file *file, unsigned int cmd, unsigned long ar
 		break;
 	case TC_NS_CLIENT_IOCTL_LATEINIT:
 		ret = tc_ns_late_init(arg);
+		/* file system is reachable now, load the registered TAs */
+		if (!ret)
+			ta_preload_late_init();
 		break;
 	default:
 		tloge("invalid cmd!");
@@ -724,9 +787,20 @@ static long tc_client_ioctl(struct file *file, unsigned int cmd,
 	case TC_NS_CLIENT_IOCTL_SEND_CMD_REQ:
 		ret = tc_client_session_ioctl(file, cmd, arg);
 		break;
+	case TC_NS_CLIENT_IOCTL_SEND_CMD_VEC:
+		ret = tc_ns_send_cmd_vec(file->private_data, argp);
+		break;
 	case TC_NS_CLIENT_IOCTL_LOAD_APP_REQ:
 		ret = tc_ns_load_secfile(file->private_data, argp);
 		break;
+	case TC_NS_CLIENT_IOCTL_LOAD_APP_SEG:
+		ret = tc_ns_load_secfile_seg(file->private_data, argp);
+		break;
+#ifdef CONFIG_TA_PRELOAD
+	case TC_NS_CLIENT_IOCTL_PRELOAD_TA:
+		ret = tc_ns_preload_ta(argp);
+		break;
+#endif
 	case TC_NS_CLIENT_IOCTL_CANCEL_CMD_REQ:
 		ret = tc_ns_send_cancel_cmd(file->private_data, argp);
 		break;
@@ -748,6 +822,14 @@ static long tc_client_ioctl(struct file *file, unsigned int cmd,
 	case TC_NS_CLIENT_IOCTL_GET_TEE_VERSION:
 		ret = tc_ns_get_tee_version(file->private_data, argp);
 		break;
+#ifdef CONFIG_SHARED_MEM_PAGELIST
+	case TC_NS_CLIENT_IOCTL_REG_FIXED_BUF:
+		ret = tc_mem_register_fixed_buf(file->private_data, argp);
+		break;
+	case TC_NS_CLIENT_IOCTL_UNREG_FIXED_BUF:
+		ret = tc_mem_unregister_fixed_buf(file->private_data, argp);
+		break;
+#endif
 	default:
 		tloge("invalid cmd 0x%x!", cmd);
 		break;
@@ -784,8 +866,8 @@ static int teec_daemon_close(struct tc_ns_dev_file *dev)
 		return -EINVAL;
 	}
 
-	del_dev_node(dev);
-	kfree(dev);
+	/* lookups under rcu and ref holders may still use it */
+	free_dev(dev);
 	return 0;
 }
 
@@ -823,21 +905,101 @@ static int tc_client_close(struct inode *inode, struct file *file)
 	return ret;
 }
 
+/* lockless lookup, the dev file returned must be put by put_dev_file */
 struct tc_ns_dev_file *tc_find_dev_file(unsigned int dev_file_id)
 {
 	struct tc_ns_dev_file *dev_file = NULL;
 
+	rcu_read_lock();
+	dev_file = radix_tree_lookup(&g_tc_ns_dev_list.dev_file_tree,
+		dev_file_id);
+	if (dev_file && !atomic_inc_not_zero(&dev_file->usage))
+		dev_file = NULL;
+	rcu_read_unlock();
+
+	return dev_file;
+}
+
+void dump_dev_mailbox_usage(void)
+{
+	struct tc_ns_dev_file *dev_file = NULL;
+
 	mutex_lock(&g_tc_ns_dev_list.dev_lock);
 	list_for_each_entry(dev_file, &g_tc_ns_dev_list.dev_file_list, head) {
-		if (dev_file->dev_file_id == dev_file_id) {
-			mutex_unlock(&g_tc_ns_dev_list.dev_lock);
-			return dev_file;
-		}
+		if (atomic_read(&dev_file->mb_usage))
+			tloge("dev file %u, kernel api %u, mailbox usage %d\n",
+				dev_file->dev_file_id, dev_file->kernel_api,
+				atomic_read(&dev_file->mb_usage));
 	}
 	mutex_unlock(&g_tc_ns_dev_list.dev_lock);
-	return NULL;
 }
 
+#if defined(CONFIG_IO_URING) && \
+	(KERNEL_VERSION(5, 19, 0) <= LINUX_VERSION_CODE)
+static const void *uring_cmd_payload(const struct io_uring_cmd *ioucmd)
+{
+#if (KERNEL_VERSION(6, 6, 0) <= LINUX_VERSION_CODE)
+	return io_uring_sqe_cmd(ioucmd->sqe);
+#else
+	return ioucmd->cmd;
+#endif
+}
+
+static unsigned long uring_cmd_context(const struct io_uring_cmd *ioucmd,
+	unsigned int issue_flags)
+{
+	const struct tc_ns_client_uring_cmd *payload =
+		uring_cmd_payload(ioucmd);
+
+#ifdef CONFIG_COMPAT
+	/*
+	 * a 32-bit CA may leave the high word of addr unset; before 6.7
+	 * io workers of the CA inherit its 32-bit thread flag on arm64
+	 */
+#if (KERNEL_VERSION(6, 7, 0) <= LINUX_VERSION_CODE)
+	if (issue_flags & IO_URING_F_COMPAT)
+#else
+	if (in_compat_syscall())
+#endif
+		return (unsigned long)(uintptr_t)compat_ptr(
+			(compat_uptr_t)payload->addr);
+#endif
+	(void)issue_flags;
+	return (unsigned long)payload->addr;
+}
+
+/*
+ * the invoke blocks until TA returns, so it is never run inline:
+ * -EAGAIN makes io_uring reissue it from an io-wq worker of the CA,
+ * which shares its mm and creds, and the result goes to the CQ;
+ * each request in flight still holds one io-wq worker
+ */
+static int tc_client_uring_cmd(struct io_uring_cmd *ioucmd,
+	unsigned int issue_flags)
+{
+	struct tc_ns_dev_file *dev_file = ioucmd->file->private_data;
+
+	if (!dev_file || dev_file->kernel_api != TEE_REQ_FROM_USER_MODE)
+		return -EINVAL;
+
+	switch (ioucmd->cmd_op) {
+	case TC_NS_CLIENT_IOCTL_SES_OPEN_REQ:
+	case TC_NS_CLIENT_IOCTL_SES_CLOSE_REQ:
+	case TC_NS_CLIENT_IOCTL_SEND_CMD_REQ:
+		break;
+	default:
+		tloge("invalid uring cmd 0x%x!\n", ioucmd->cmd_op);
+		return -EINVAL;
+	}
+
+	if (issue_flags & IO_URING_F_NONBLOCK)
+		return -EAGAIN;
+
+	return tc_client_session_uring_cmd(ioucmd->file, ioucmd->cmd_op,
+		uring_cmd_context(ioucmd, issue_flags));
+}
+#endif
+
 #ifdef CONFIG_COMPAT
 long tc_compat_client_ioctl(struct file *file, unsigned int cmd,
 	unsigned long arg)
@@ -862,6 +1024,10 @@ static const struct file_operations g_tc_ns_client_fops = {
 #ifdef CONFIG_COMPAT
 	.compat_ioctl = tc_compat_client_ioctl,
 #endif
+#if defined(CONFIG_IO_URING) && \
+	(KERNEL_VERSION(5, 19, 0) <= LINUX_VERSION_CODE)
+	.uring_cmd = tc_client_uring_cmd,
+#endif
 };
 
 #ifdef CONFIG_ACPI
@@ -996,6 +1162,7 @@ static int tc_ns_client_init(struct device **class_dev)
 		goto class_device_destroy;
 
 	INIT_LIST_HEAD(&g_tc_ns_dev_list.dev_file_list);
+	INIT_RADIX_TREE(&g_tc_ns_dev_list.dev_file_tree, GFP_KERNEL);
 	mutex_init(&g_tc_ns_dev_list.dev_lock);
 	init_crypto_hash_lock();
 	init_srvc_list();
@@ -1031,6 +1198,13 @@ static int tc_teeos_init(struct device *class_dev)
 		tloge("tz spi init failed\n");
 		goto release_mailbox;
 	}
+
+	/* ion params are only refused if it fails */
+	if (tc_dmabuf_init())
+		tloge("dma buf init failed\n");
+	/* fds are closed by their closing task if it fails */
+	if (tc_ns_teardown_init())
+		tloge("teardown init failed\n");
 	return 0;
 release_mailbox:
 	mailbox_mempool_destroy();
@@ -1090,6 +1264,10 @@ class_device_destroy:
 static void tc_exit(void)
 {
 	tlogd("tz client exit");
+	/* pinned sessions are closed while tee can still be called */
+	ta_preload_exit();
+	tc_ns_teardown_exit();
+	tc_dmabuf_exit();
 	tz_spi_exit();
 	/* run-time environment exit should before teeos exit */
 	device_destroy(g_driver_class, g_tc_ns_client_devt);
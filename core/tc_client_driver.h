@@ -24,9 +24,11 @@
 struct tc_ns_dev_list *get_dev_list(void);
 uint32_t tc_ns_get_uid(void);
 struct tc_ns_dev_file *tc_find_dev_file(unsigned int dev_file_id);
+void put_dev_file(struct tc_ns_dev_file *dev);
 int tc_ns_client_open(struct tc_ns_dev_file **dev_file, uint8_t kernel_api);
 int tc_ns_client_close(struct tc_ns_dev_file *dev);
 int is_agent_alive(unsigned int agent_id);
+void dump_dev_mailbox_usage(void);
 
 #ifdef CONFIG_ACPI
 int get_acpi_tz_irq(void);
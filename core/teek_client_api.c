@@ -24,10 +24,14 @@
 #include <linux/sched.h>
 #include <linux/list.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
 #include <asm/cacheflush.h>
 #include <linux/kthread.h>
 #include <linux/freezer.h>
 #include <linux/kernel.h>
+#include <linux/workqueue.h>
+#include <linux/wait.h>
+#include <linux/jiffies.h>
 #include <securec.h>
 #include "teek_client_id.h"
 #include "tc_ns_log.h"
@@ -725,6 +729,285 @@ uint32_t teek_register_shared_memory(struct teec_context *context,
 	return TEEC_ERROR_NOT_SUPPORTED;
 }
 
+/*
+ * session pool: kernel clients borrow sessions opened before instead of
+ * paying the TA load check and the open/close smcs per operation
+ */
+struct teek_pool_session {
+	struct list_head head;
+	struct teec_session session;
+	unsigned long idle_since; /* jiffies */
+};
+
+struct teek_session_pool {
+	struct teec_context *context;
+	struct teec_uuid uuid;
+	uint32_t method;
+	/* login params of opens, its buffers live as long as the pool */
+	struct teec_operation operation;
+	struct teek_session_pool_cfg cfg;
+	/*
+	 * for the fields below; a spinlock as destroy frees the pool once
+	 * it got the lock after the last put, a mutex_unlock may still
+	 * touch the mutex then
+	 */
+	spinlock_t lock;
+	struct list_head idle_list; /* most recently used first */
+	uint32_t num; /* opened, idle and borrowed */
+	uint32_t borrowed; /* and borrowers waiting, destroy waits for all */
+	bool dying;
+	wait_queue_head_t wait; /* for borrowers and destroy */
+	struct delayed_work reap_work;
+};
+
+static uint32_t pool_open_session(struct teek_session_pool *pool,
+	struct teek_pool_session **out, uint32_t *origin)
+{
+	struct teek_pool_session *pool_sess = NULL;
+	uint32_t ret;
+
+	pool_sess = kzalloc(sizeof(*pool_sess), GFP_KERNEL);
+	if (ZERO_OR_NULL_PTR((unsigned long)(uintptr_t)pool_sess)) {
+		tloge("alloc pool session failed\n");
+		return TEEC_ERROR_OUT_OF_MEMORY;
+	}
+
+	ret = teek_open_session(pool->context, &pool_sess->session,
+		&pool->uuid, pool->method, NULL, &pool->operation, origin);
+	if (ret != TEEC_SUCCESS) {
+		tloge("pool open session failed, ret=0x%x\n", ret);
+		kfree(pool_sess);
+		return ret;
+	}
+	*out = pool_sess;
+	return TEEC_SUCCESS;
+}
+
+static void pool_close_session(struct teek_pool_session *pool_sess)
+{
+	teek_close_session(&pool_sess->session);
+	kfree(pool_sess);
+}
+
+/* close idle sessions above min_num that were not used for idle_ms */
+static void pool_reap_work_fn(struct work_struct *work)
+{
+	struct teek_session_pool *pool = container_of(to_delayed_work(work),
+		struct teek_session_pool, reap_work);
+	unsigned long timeout = msecs_to_jiffies(pool->cfg.idle_ms);
+	struct teek_pool_session *pool_sess = NULL;
+	struct teek_pool_session *tmp = NULL;
+	LIST_HEAD(reap_list);
+
+	spin_lock(&pool->lock);
+	list_for_each_entry_safe_reverse(pool_sess, tmp,
+		&pool->idle_list, head) {
+		if (pool->num <= pool->cfg.min_num ||
+			time_before(jiffies, pool_sess->idle_since + timeout))
+			break;
+		list_move(&pool_sess->head, &reap_list);
+		pool->num--;
+	}
+	if (!pool->dying)
+		schedule_delayed_work(&pool->reap_work, timeout);
+	spin_unlock(&pool->lock);
+
+	list_for_each_entry_safe(pool_sess, tmp, &reap_list, head) {
+		list_del(&pool_sess->head);
+		pool_close_session(pool_sess);
+	}
+	wake_up(&pool->wait);
+}
+
+static bool is_pool_cfg_valid(const struct teek_session_pool_cfg *cfg)
+{
+	return cfg && cfg->max_num && cfg->max_num <= TEEK_POOL_MAX_SESSIONS &&
+		cfg->min_num <= cfg->max_num && cfg->idle_ms;
+}
+
+/*
+ * sessions are opened on context with operation holding the login
+ * params, as teek_open_session; min_num of them are opened here
+ */
+struct teek_session_pool *teek_create_session_pool(
+	struct teec_context *context,
+	const struct teec_uuid *destination,
+	uint32_t connection_method,
+	const struct teec_operation *operation,
+	const struct teek_session_pool_cfg *cfg)
+{
+	struct teek_session_pool *pool = NULL;
+	struct teek_pool_session *pool_sess = NULL;
+	uint32_t origin = TEEC_ORIGIN_API;
+	uint32_t i;
+
+	if (!context || !destination || !operation ||
+		!is_pool_cfg_valid(cfg)) {
+		tloge("invalid session pool params\n");
+		return NULL;
+	}
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (ZERO_OR_NULL_PTR((unsigned long)(uintptr_t)pool)) {
+		tloge("alloc session pool failed\n");
+		return NULL;
+	}
+	pool->context = context;
+	pool->uuid = *destination;
+	pool->method = connection_method;
+	pool->operation = *operation;
+	pool->cfg = *cfg;
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->idle_list);
+	init_waitqueue_head(&pool->wait);
+	INIT_DELAYED_WORK(&pool->reap_work, pool_reap_work_fn);
+
+	for (i = 0; i < cfg->min_num; i++) {
+		if (pool_open_session(pool, &pool_sess, &origin) !=
+			TEEC_SUCCESS) {
+			teek_destroy_session_pool(pool);
+			return NULL;
+		}
+		pool_sess->idle_since = jiffies;
+		list_add_tail(&pool_sess->head, &pool->idle_list);
+		pool->num++;
+	}
+
+	schedule_delayed_work(&pool->reap_work,
+		msecs_to_jiffies(cfg->idle_ms));
+	return pool;
+}
+EXPORT_SYMBOL(teek_create_session_pool);
+
+/* all borrowed sessions must be put before, destroy waits for them */
+void teek_destroy_session_pool(struct teek_session_pool *pool)
+{
+	struct teek_pool_session *pool_sess = NULL;
+	struct teek_pool_session *tmp = NULL;
+
+	if (!pool)
+		return;
+
+	spin_lock(&pool->lock);
+	pool->dying = true;
+	spin_unlock(&pool->lock);
+	/* borrowers waiting for a session fail */
+	wake_up(&pool->wait);
+	cancel_delayed_work_sync(&pool->reap_work);
+
+	/* the last put wakes us under the lock, it is done once we got it */
+	spin_lock(&pool->lock);
+	wait_event_cmd(pool->wait, !pool->borrowed,
+		spin_unlock(&pool->lock), spin_lock(&pool->lock));
+	spin_unlock(&pool->lock);
+	list_for_each_entry_safe(pool_sess, tmp, &pool->idle_list, head) {
+		list_del(&pool_sess->head);
+		pool_close_session(pool_sess);
+	}
+	kfree(pool);
+}
+EXPORT_SYMBOL(teek_destroy_session_pool);
+
+/* lockless hint for wait_event, get_session checks again under lock */
+static bool pool_can_borrow(struct teek_session_pool *pool)
+{
+	return READ_ONCE(pool->dying) ||
+		!list_empty_careful(&pool->idle_list) ||
+		READ_ONCE(pool->num) < pool->cfg.max_num;
+}
+
+/*
+ * borrow a session of the pool, an idle one if any, else a new one
+ * while there are less than max_num, else wait for one put back
+ */
+uint32_t teek_pool_get_session(struct teek_session_pool *pool,
+	struct teec_session **session, uint32_t *return_origin)
+{
+	struct teek_pool_session *pool_sess = NULL;
+	uint32_t origin = TEEC_ORIGIN_API;
+	uint32_t ret;
+
+	if (!pool || !session) {
+		ret = TEEC_ERROR_BAD_PARAMETERS;
+		goto set_ori;
+	}
+
+	spin_lock(&pool->lock);
+	pool->borrowed++;
+	while (!pool->dying && list_empty(&pool->idle_list) &&
+		pool->num >= pool->cfg.max_num) {
+		spin_unlock(&pool->lock);
+		wait_event(pool->wait, pool_can_borrow(pool));
+		spin_lock(&pool->lock);
+	}
+	if (pool->dying) {
+		pool->borrowed--;
+		wake_up(&pool->wait);
+		spin_unlock(&pool->lock);
+		ret = TEEC_ERROR_BAD_STATE;
+		goto set_ori;
+	}
+
+	pool_sess = list_first_entry_or_null(&pool->idle_list,
+		struct teek_pool_session, head);
+	if (pool_sess)
+		list_del(&pool_sess->head);
+	else
+		pool->num++; /* hold the slot while opening */
+	spin_unlock(&pool->lock);
+
+	if (!pool_sess) {
+		ret = pool_open_session(pool, &pool_sess, &origin);
+		if (ret != TEEC_SUCCESS) {
+			/* destroy may free the pool once borrowed drops */
+			spin_lock(&pool->lock);
+			pool->num--;
+			pool->borrowed--;
+			wake_up(&pool->wait);
+			spin_unlock(&pool->lock);
+			goto set_ori;
+		}
+	}
+	*session = &pool_sess->session;
+	return TEEC_SUCCESS;
+
+set_ori:
+	if (return_origin)
+		*return_origin = origin;
+	return ret;
+}
+EXPORT_SYMBOL(teek_pool_get_session);
+
+/*
+ * put back a borrowed session, a session the client can't trust any
+ * more (TA died, cmd was cancelled) is put with reusable false
+ */
+void teek_pool_put_session(struct teek_session_pool *pool,
+	struct teec_session *session, bool reusable)
+{
+	struct teek_pool_session *pool_sess = NULL;
+
+	if (!pool || !session)
+		return;
+
+	pool_sess = container_of(session, struct teek_pool_session, session);
+	/* the pool can't be touched after borrowed drops, close it first */
+	if (!reusable)
+		pool_close_session(pool_sess);
+
+	spin_lock(&pool->lock);
+	if (reusable) {
+		pool_sess->idle_since = jiffies;
+		list_add(&pool_sess->head, &pool->idle_list);
+	} else {
+		pool->num--;
+	}
+	pool->borrowed--;
+	wake_up(&pool->wait);
+	spin_unlock(&pool->lock);
+}
+EXPORT_SYMBOL(teek_pool_put_session);
+
 /* begin: for KERNEL-HAL out interface */
 int TEEK_IsAgentAlive(unsigned int agent_id)
 {
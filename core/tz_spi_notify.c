@@ -212,51 +212,36 @@ static int find_notify_sess(
 	struct tc_ns_session **temp_ses, bool *enc_found)
 {
 	struct tc_ns_dev_file *temp_dev_file = NULL;
-	struct tc_ns_dev_list *dev_list = NULL;
 	struct tc_ns_service *temp_svc = NULL;
 
-	dev_list = get_dev_list();
-	if (!dev_list) {
-		tloge("dev list is invalid\n");
-		return -ENOENT;
+	temp_dev_file = tc_find_dev_file(tc_notify_data_timer->dev_file_id);
+	if (!temp_dev_file) {
+		tlogd("dev file %u is closed\n",
+			tc_notify_data_timer->dev_file_id);
+		return 0;
 	}
 
-	mutex_lock(&dev_list->dev_lock);
-	list_for_each_entry(temp_dev_file, &dev_list->dev_file_list, head) {
-		tlogd("dev file id1 = %u, id2 = %u\n",
-		      temp_dev_file->dev_file_id,
-		      tc_notify_data_timer->dev_file_id);
-		if (temp_dev_file->dev_file_id ==
-			tc_notify_data_timer->dev_file_id) {
-			mutex_lock(&temp_dev_file->service_lock);
-			temp_svc =
-				tc_find_service_in_dev(temp_dev_file,
-					tc_notify_data_timer->uuid, UUID_LEN);
-			mutex_unlock(&temp_dev_file->service_lock);
-			if (!temp_svc)
-				break;
-			get_service_struct(temp_svc);
-			mutex_lock(&temp_svc->session_lock);
-			*temp_ses =
-				tc_find_session_withowner(
-					&temp_svc->session_list,
-					tc_notify_data_timer->session_id,
-					temp_dev_file);
-			get_session_struct(*temp_ses);
-			mutex_unlock(&temp_svc->session_lock);
-			put_service_struct(temp_svc);
-			temp_svc = NULL;
-			if (*temp_ses) {
-				tlogd("send cmd ses id %u\n",
-					(*temp_ses)->session_id);
-				*enc_found = true;
-				break;
-			}
-			break;
-		}
+	mutex_lock(&temp_dev_file->service_lock);
+	temp_svc = tc_find_service_in_dev(temp_dev_file,
+		tc_notify_data_timer->uuid, UUID_LEN);
+	get_service_struct(temp_svc);
+	mutex_unlock(&temp_dev_file->service_lock);
+	if (!temp_svc)
+		goto put_dev;
+
+	mutex_lock(&temp_svc->session_lock);
+	*temp_ses = tc_find_session_withowner(&temp_svc->session_list,
+		tc_notify_data_timer->session_id, temp_dev_file);
+	get_session_struct(*temp_ses);
+	mutex_unlock(&temp_svc->session_lock);
+	put_service_struct(temp_svc);
+	if (*temp_ses) {
+		tlogd("send cmd ses id %u\n", (*temp_ses)->session_id);
+		*enc_found = true;
 	}
-	mutex_unlock(&dev_list->dev_lock);
 
+put_dev:
+	put_dev_file(temp_dev_file);
 	return 0;
 }
 
@@ -107,6 +107,22 @@ struct load_secfile_ioctl_struct {
 	};
 };
 
+/*
+ * one segment of a secfile loaded in pieces, segments come in order on
+ * one fd: offset 0 starts the load, the one ending at total_size ends it
+ */
+struct load_secfile_seg_ioctl_struct {
+	enum secfile_type_t secfile_type;
+	unsigned char uuid[UUID_LEN];
+	uint32_t seg_size;
+	uint64_t total_size;
+	uint64_t offset;
+	union {
+		char *file_buffer;
+		unsigned long long file_addr;
+	};
+};
+
 struct agent_ioctl_args {
 	uint32_t id;
 	uint32_t buffer_size;
@@ -116,6 +132,54 @@ struct agent_ioctl_args {
 	};
 };
 
+struct tc_ns_client_fixed_buf {
+	union {
+		void *buffer;
+		unsigned long long addr;
+	};
+	uint32_t size;
+	uint32_t index; /* out of register, in of unregister */
+};
+
+#define TA_PRELOAD_PATH_LEN 256
+#define TA_PRELOAD_NAME_LEN 256
+#define TA_PRELOAD_PIN 0x1 /* keep a session open so the TA stays loaded */
+#define TA_PRELOAD_REMOVE 0x2 /* drop the entry and its pin session */
+
+/*
+ * TA image teecd registers from its manifest, loaded in background
+ * after late init; a pin session logs in as pkg_name
+ */
+struct tc_ns_client_preload {
+	unsigned char uuid[UUID_LEN];
+	uint32_t flags;
+	char path[TA_PRELOAD_PATH_LEN];
+	char pkg_name[TA_PRELOAD_NAME_LEN];
+};
+
+#define MAX_CMD_VEC_NUM 16
+
+/* invokes run in order, done is the number of entries that succeeded */
+struct tc_ns_client_cmd_vec {
+	union {
+		struct tc_ns_client_context *contexts;
+		unsigned long long addr;
+	};
+	uint32_t num;
+	uint32_t done;
+};
+
+/*
+ * payload of io_uring IORING_OP_URING_CMD, cmd_op is one of
+ * SES_OPEN_REQ, SES_CLOSE_REQ and SEND_CMD_REQ ioctl numbers
+ */
+struct tc_ns_client_uring_cmd {
+	union {
+		struct tc_ns_client_context *context;
+		unsigned long long addr;
+	};
+};
+
 struct tc_ns_client_crl {
 	union {
 		uint8_t *buffer;
@@ -174,5 +238,15 @@ struct tc_ns_client_crl {
 	_IOWR(TC_NS_CLIENT_IOC_MAGIC, 21, unsigned int)
 #define TC_NS_CLIENT_IOCTL_UPDATE_TA_CRL\
 	_IOWR(TC_NS_CLIENT_IOC_MAGIC, 22, struct tc_ns_client_crl)
+#define TC_NS_CLIENT_IOCTL_REG_FIXED_BUF \
+	_IOWR(TC_NS_CLIENT_IOC_MAGIC, 23, struct tc_ns_client_fixed_buf)
+#define TC_NS_CLIENT_IOCTL_UNREG_FIXED_BUF \
+	_IOWR(TC_NS_CLIENT_IOC_MAGIC, 24, struct tc_ns_client_fixed_buf)
+#define TC_NS_CLIENT_IOCTL_SEND_CMD_VEC \
+	_IOWR(TC_NS_CLIENT_IOC_MAGIC, 25, struct tc_ns_client_cmd_vec)
+#define TC_NS_CLIENT_IOCTL_LOAD_APP_SEG \
+	_IOWR(TC_NS_CLIENT_IOC_MAGIC, 26, struct load_secfile_seg_ioctl_struct)
+#define TC_NS_CLIENT_IOCTL_PRELOAD_TA \
+	_IOWR(TC_NS_CLIENT_IOC_MAGIC, 27, struct tc_ns_client_preload)
 
 #endif
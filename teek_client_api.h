@@ -30,6 +30,17 @@
 
 #define TEEC_VALUE_UNDEF 0xFFFFFFFF
 
+#define TEEK_POOL_MAX_SESSIONS 64
+
+/* sessions to one TA kept open for kernel clients to borrow */
+struct teek_session_pool_cfg {
+	uint32_t min_num; /* kept open even when idle */
+	uint32_t max_num; /* borrowers wait when this many are out */
+	uint32_t idle_ms; /* idle sessions above min_num are closed after */
+};
+
+struct teek_session_pool;
+
 #ifdef CONFIG_KERNEL_CLIENT
 
 /*
@@ -95,6 +106,21 @@ TEEC_Result TEEK_InvokeCommand(TEEC_Session *session,
 	TEEC_Operation *operation,
 	uint32_t *returnOrigin);
 
+struct teek_session_pool *teek_create_session_pool(
+	struct teec_context *context,
+	const struct teec_uuid *destination,
+	uint32_t connection_method,
+	const struct teec_operation *operation,
+	const struct teek_session_pool_cfg *cfg);
+
+void teek_destroy_session_pool(struct teek_session_pool *pool);
+
+uint32_t teek_pool_get_session(struct teek_session_pool *pool,
+	struct teec_session **session, uint32_t *return_origin);
+
+void teek_pool_put_session(struct teek_session_pool *pool,
+	struct teec_session *session, bool reusable);
+
 #else
 
 static inline int teek_is_agent_alive(unsigned int agent_id)
@@ -177,6 +203,34 @@ static inline uint32_t teek_send_secfile(struct teec_session *session,
 	return TEEC_SUCCESS;
 }
 
+static inline struct teek_session_pool *teek_create_session_pool(
+	struct teec_context *context,
+	const struct teec_uuid *destination,
+	uint32_t connection_method,
+	const struct teec_operation *operation,
+	const struct teek_session_pool_cfg *cfg)
+{
+	return NULL;
+}
+
+static inline void teek_destroy_session_pool(struct teek_session_pool *pool)
+{
+	(void)pool;
+}
+
+static inline uint32_t teek_pool_get_session(struct teek_session_pool *pool,
+	struct teec_session **session, uint32_t *return_origin)
+{
+	return TEEC_ERROR_NOT_SUPPORTED;
+}
+
+static inline void teek_pool_put_session(struct teek_session_pool *pool,
+	struct teec_session *session, bool reusable)
+{
+	(void)pool;
+	(void)session;
+}
+
 #endif
 
 #endif
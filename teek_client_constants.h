@@ -54,6 +54,14 @@ enum global_service_cmd_id {
 	GLOBAL_CMD_ID_SET_SERVE_CMD = 0x1b,
 	GLOBAL_CMD_ID_LATE_INIT = 0x20,
 	GLOBAL_CMD_ID_GET_TEE_VERSION = 0x22,
+	/*
+	 * only sent with CONFIG_SHARED_MEM_PAGELIST,
+	 * the TEE must implement them
+	 */
+	GLOBAL_CMD_ID_REGISTER_FIXED_MEM = 0x23,
+	GLOBAL_CMD_ID_UNREGISTER_FIXED_MEM = 0x24,
+	/* only sent with CONFIG_TEE_CLOSE_SESSION_BATCH */
+	GLOBAL_CMD_ID_CLOSE_SESSION_BATCH = 0x25,
 	GLOBAL_CMD_ID_UNKNOWN = 0x7FFFFFFE,
 	GLOBAL_CMD_ID_MAX = 0x7FFFFFFF
 };
@@ -131,6 +139,7 @@ enum TEEC_ParamType {
 	TEEC_MEMREF_TEMP_INOUT = 0x07,
 	TEEC_ION_INPUT = 0x08,
 	TEEC_ION_SGLIST_INPUT = 0x09,
+	TEEC_MEMREF_FIXED_INOUT = 0xa, /* buffer is fixed buf index */
 	TEEC_MEMREF_WHOLE = 0xc,
 	TEEC_MEMREF_PARTIAL_INPUT = 0xd,
 	TEEC_MEMREF_PARTIAL_OUTPUT = 0xe,
@@ -147,6 +156,15 @@ enum TEE_ParamType {
 	TEE_PARAM_TYPE_MEMREF_INOUT = 0x7,
 	TEE_PARAM_TYPE_ION_INPUT = 0x8,
 	TEE_PARAM_TYPE_ION_SGLIST_INPUT = 0x9,
+	/* buffer is offset, buffer_h_addr is handle of registered fixed mem */
+	TEE_PARAM_TYPE_MEMREF_FIXED_INOUT = 0xa,
+	/*
+	 * buffer is a struct pagelist_info, only sent with
+	 * CONFIG_SHARED_MEM_PAGELIST, the TEE must implement these
+	 */
+	TEE_PARAM_TYPE_MEMREF_PAGELIST_INPUT = 0xd,
+	TEE_PARAM_TYPE_MEMREF_PAGELIST_OUTPUT = 0xe,
+	TEE_PARAM_TYPE_MEMREF_PAGELIST_INOUT = 0xf,
 };
 
 enum TEEC_LoginMethod {
@@ -22,6 +22,9 @@
 #include <linux/list.h>
 #include <linux/slab.h>
 #include <linux/completion.h>
+#include <linux/radix-tree.h>
+#include <linux/rcupdate.h>
+#include <linux/workqueue.h>
 #include <securec.h>
 #include "tc_ns_client.h"
 #include "tc_ns_log.h"
@@ -51,9 +54,13 @@
   */
 #define MAX_PUBKEY_LEN 1024
 
+#define MAX_FIXED_BUF_NUM 16 /* fixed buffers one dev file can register */
+
 struct tc_ns_dev_list {
-	struct mutex dev_lock; /* for dev_file_list */
+	struct mutex dev_lock; /* for dev_file_list and dev_file_tree */
 	struct list_head dev_file_list;
+	/* index of dev_file_list by dev_file_id, read under rcu */
+	struct radix_tree_root dev_file_tree;
 };
 
 struct tc_uuid {
@@ -72,6 +79,7 @@ struct tc_ns_shared_mem {
 	struct list_head head;
 	atomic_t usage;
 	atomic_t offset;
+	struct rcu_head rcu; /* lookup by shm_addr_tree is lockless */
 };
 
 struct tc_ns_service {
@@ -79,18 +87,27 @@ struct tc_ns_service {
 	struct mutex session_lock; /* for session_list */
 	struct list_head session_list;
 	struct list_head head;
-	struct mutex operation_lock; /* for session's open/close */
+	struct mutex operation_lock; /* session_list add vs close */
 	atomic_t usage;
+	struct rcu_head rcu;
+	/* crash gen the TA was last opened in, see is_ta_loaded */
+	uint32_t loaded_gen;
 };
 
 #define SERVICES_MAX_COUNT 32 /* service limit can opened on 1 fd */
+struct tc_ns_load_stream;
+
 struct tc_ns_dev_file {
 	unsigned int dev_file_id;
 	struct mutex service_lock; /* for service_ref[], services[] */
 	uint8_t service_ref[SERVICES_MAX_COUNT]; /* a judge if set services[i]=NULL */
 	struct tc_ns_service *services[SERVICES_MAX_COUNT];
-	struct mutex shared_mem_lock; /* for shared_mem_list */
+	struct mutex shared_mem_lock; /* for shared_mem_list and its index */
 	struct list_head shared_mem_list;
+	/* index of shared_mem_list by user page, read under rcu */
+	struct radix_tree_root shm_addr_tree;
+	/* index of shared_mem_list by mmap pgoff */
+	struct radix_tree_root shm_offset_tree;
 	struct list_head head;
 	/* Device is linked to call from kernel */
 	uint8_t kernel_api;
@@ -106,6 +123,15 @@ struct tc_ns_dev_file {
 	uint8_t pub_key[MAX_PUBKEY_LEN];
 	int load_app_flag;
 	struct completion close_comp; /* for kthread close unclosed session */
+	struct work_struct close_work; /* closes sessions left at fd close */
+	atomic_t mb_usage; /* bytes of mailbox charged to this dev file */
+	struct mutex fixed_buf_lock; /* for fixed_bufs[] */
+	struct tc_ns_fixed_buf *fixed_bufs[MAX_FIXED_BUF_NUM];
+	atomic_t usage; /* held by the fd and by tc_find_dev_file */
+	struct rcu_head rcu;
+	struct mutex load_stream_lock; /* for load_stream */
+	struct tc_ns_load_stream *load_stream; /* segmented load in progress */
+	struct delayed_work load_stream_work; /* aborts an idle load_stream */
 };
 
 union tc_ns_parameter {
@@ -135,6 +161,17 @@ struct tc_ns_operation {
 struct tc_ns_temp_buf {
 	void *temp_buffer;
 	unsigned int size;
+	struct page **pages; /* pinned user pages, temp_buffer is page list */
+	unsigned int page_num;
+};
+
+/* CA buffer pinned once and mapped by TEE until unregistered */
+struct tc_ns_fixed_buf {
+	struct tc_ns_temp_buf buf;
+	unsigned int dev_file_id;
+	uint32_t tee_handle;
+	atomic_t usage;
+	struct mm_struct *mm; /* its pages are charged to mm->pinned_vm */
 };
 
 enum smc_cmd_type {
@@ -252,6 +289,10 @@ struct tc_ns_session {
 	struct tc_wait_data wait_data;
 	struct mutex ta_session_lock; /* for open/close/invoke on 1 session */
 	struct tc_ns_dev_file *owner;
+	/* reused by every invoke, protected by ta_session_lock */
+	struct tc_ns_smc_cmd *invoke_cmd;
+	struct mb_cmd_pack *invoke_pack;
+	bool invoke_cmd_inited; /* constant fields of invoke_cmd are set */
 #ifdef CONFIG_AUTH_ENHANCE
 	/* Session secure enhanced information */
 	struct session_secure_info secure_info;
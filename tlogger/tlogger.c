@@ -22,6 +22,7 @@
 #include <linux/slab.h>
 #include <linux/version.h>
 #include <linux/delay.h>
+#include <linux/workqueue.h>
 #include <asm/ioctls.h>
 #include <linux/syscalls.h>
 #include <securec.h>
@@ -82,6 +83,11 @@ int g_tlogcat_f = 0;
 #define TEE_LOG_FILE_NAME_MAX 256
 
 u32 g_last_read_offset = 0;
+/* log end position when readers were last woken */
+static u32 g_log_wake_pos;
+
+#define LOG_WAKE_WATERMARK      SZ_1K
+#define LOG_WAKE_DELAY_MS       100
 
 #define NEVER_USED_LEN 32U
 #define LOG_ITEM_RESERVED_LEN 2U
@@ -462,10 +468,58 @@ void tz_log_write(void)
 		tlogd("wake up write tz log\n");
 		wake_up_interruptible(&g_log->wait_queue_head);
 	}
+	WRITE_ONCE(g_log_wake_pos, log_buffer->flag.last_pos);
 
 	return;
 }
 
+static void log_wake_fn(struct work_struct *work)
+{
+	(void)work;
+	tz_log_write();
+}
+
+static DECLARE_DELAYED_WORK(g_log_wake_work, log_wake_fn);
+
+/*
+ * called after every invoke, only looks how far TEE wrote since
+ * readers were last woken: past the watermark they are woken at once,
+ * below it the wakeup is deferred, so that invokes logging nothing
+ * wake nobody and small logs of a burst are read in one go
+ */
+void tz_log_update(void)
+{
+	const struct log_buffer *log_buffer = NULL;
+	u32 last_pos;
+	u32 wake_pos;
+	u32 pending;
+
+	if (!g_log)
+		return;
+
+	log_buffer = (struct log_buffer *)g_log->buffer_info;
+	if (!log_buffer)
+		return;
+
+	last_pos = READ_ONCE(log_buffer->flag.last_pos);
+	wake_pos = READ_ONCE(g_log_wake_pos);
+	if (last_pos == wake_pos)
+		return;
+
+	if (last_pos > wake_pos)
+		pending = last_pos - wake_pos;
+	else if (log_buffer->flag.max_len >= wake_pos)
+		pending = log_buffer->flag.max_len - wake_pos + last_pos;
+	else
+		pending = last_pos;
+
+	if (pending >= LOG_WAKE_WATERMARK)
+		tz_log_write();
+	else
+		schedule_delayed_work(&g_log_wake_work,
+			msecs_to_jiffies(LOG_WAKE_DELAY_MS));
+}
+
 static struct tlogger_log *get_tlogger_log_by_minor(int minor)
 {
 	struct tlogger_log *log = NULL;
@@ -1204,6 +1258,7 @@ static void unregister_tlogger(void)
 	struct tlogger_log *current_log = NULL;
 	struct tlogger_log *next_log = NULL;
 
+	cancel_delayed_work_sync(&g_log_wake_work);
 	list_for_each_entry_safe(current_log, next_log, &m_log_list, logs) {
 		/* we have to delete all the entry inside m_log_list */
 		misc_deregister(&current_log->misc_device);
@@ -22,6 +22,7 @@
 
 #ifdef CONFIG_TEELOG
 void tz_log_write(void);
+void tz_log_update(void);
 int tlogger_store_msg(const char *file_path, u32 file_path_len);
 int register_mem_to_teeos(u64 mem_addr, u32 mem_len, bool is_cache_mem);
 
@@ -36,6 +37,11 @@ static inline void tz_log_write(void)
 	return;
 }
 
+static inline void tz_log_update(void)
+{
+	return;
+}
+
 static inline int tlogger_store_msg(const char *file_path, u32 file_path_len)
 {
 	(void)file_path;